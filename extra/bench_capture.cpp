@@ -0,0 +1,182 @@
+// Frame readback benchmark
+//
+// Usage: bench_capture [width] [height] [frames]
+//
+// Draws a frame of many small triangles into a framebuffer object
+// (1280x720 and 300 frames by default) and reads every frame back,
+// comparing:
+// - sync:   FrameBufferObject::read, glReadPixels into client memory
+// - ring N: FrameCapture with N pixel pack buffers, mapped two frames later
+// and reports the frame times, how often the capture waited for the GPU
+// and the latency from drawing a frame to its pixels reaching the consumer.
+
+#include "Helpers.h"
+#include "FrameCapture.h"
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+static const char *vertexShader =
+  "#version 150 core\n"
+  "in vec2 position;"
+  "uniform float time;"
+  "out vec3 Color;"
+  "void main()"
+  "{"
+  "    vec2 p = position + 0.02 * vec2(sin(time + 40.0 * position.y), cos(time + 40.0 * position.x));"
+  "    Color = vec3(0.5 + 0.5 * p, 0.5);"
+  "    gl_Position = vec4(p, 0.0, 1.0);"
+  "}";
+
+static const char *fragmentShader =
+  "#version 150 core\n"
+  "in vec3 Color;"
+  "out vec4 outColor;"
+  "void main()"
+  "{"
+  "    outColor = vec4(Color, 1.0);"
+  "}";
+
+typedef std::chrono::high_resolution_clock Clock;
+
+int main(int argc, char *argv[])
+{
+  int width = argc > 1 ? atoi(argv[1]) : 1280;
+  int height = argc > 2 ? atoi(argv[2]) : 720;
+  int frames = argc > 3 ? atoi(argv[3]) : 300;
+  const int warmup = 10;
+
+  if (!glfwInit())
+    return -1;
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+  glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+#ifdef __APPLE__
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+  GLFWwindow *window = glfwCreateWindow(64, 64, "bench_capture", NULL, NULL);
+  if (!window)
+  {
+    glfwTerminate();
+    return -1;
+  }
+  glfwMakeContextCurrent(window);
+  glfwSwapInterval(0);
+#ifndef __APPLE__
+  glewExperimental = true;
+  if (glewInit() != GLEW_OK)
+  {
+    std::cerr << "Cannot initialize GLEW" << std::endl;
+    return -1;
+  }
+  glGetError();
+#endif
+
+  Program program;
+  if (!program.init(vertexShader, fragmentShader, "outColor"))
+    return -1;
+  program.bind();
+
+  FrameBufferObject target;
+  if (!target.init(width, height))
+    return -1;
+  target.bind();
+
+  // A grid of small triangles covering the frame
+  const int cells = 200;
+  Eigen::MatrixXf V(2, cells * cells * 3);
+  for (int y = 0; y < cells; ++y)
+    for (int x = 0; x < cells; ++x)
+    {
+      float px = 2.0f * x / cells - 1, py = 2.0f * y / cells - 1, d = 2.0f / cells;
+      int i = (y * cells + x) * 3;
+      V.col(i) << px, py;
+      V.col(i + 1) << px + d, py;
+      V.col(i + 2) << px, py + d;
+    }
+  VertexArrayObject VAO;
+  VAO.init();
+  VAO.bind();
+  VertexBufferObject VBO;
+  VBO.init();
+  VBO.update(V);
+  program.bindVertexAttribArray("position", VBO);
+
+  printf("%dx%d, %d frames\n", width, height, frames);
+  printf("%-8s %10s %10s %10s %8s %12s\n", "method", "mean ms", "p99 ms", "fps", "stalls", "latency ms");
+  for (int buffers = 0; buffers <= 4; ++buffers)
+  {
+    if (buffers == 1)
+      continue;
+
+    // The consumer sums a byte per row, as cheap as a real consumer that
+    // only copies the pixels out
+    std::vector<Clock::time_point> drawn;
+    double latency = 0;
+    unsigned int checksum = 0;
+    FrameCapture capture;
+    capture.consumer = [&](const CapturedFrame &frame) {
+      for (int y = 0; y < frame.height; ++y)
+        checksum += frame.pixels[size_t(y) * frame.width * 4];
+      if (frame.frame >= (unsigned int) warmup)
+        latency += std::chrono::duration<double, std::milli>(Clock::now() - drawn[frame.frame]).count();
+    };
+    if (buffers > 0)
+      capture.init(buffers);
+    std::vector<unsigned char> rgb;
+
+    std::vector<double> times;
+    Clock::time_point start;
+    for (int frame = 0; frame < warmup + frames; ++frame)
+    {
+      if (frame == warmup)
+        start = Clock::now();
+      Clock::time_point t0 = Clock::now();
+      glUniform1f(program.uniform("time"), frame * 0.05f);
+      glClear(GL_COLOR_BUFFER_BIT);
+      glDrawArrays(GL_TRIANGLES, 0, (GLsizei) V.cols());
+      drawn.push_back(Clock::now());
+      if (buffers == 0)
+      {
+        target.read(rgb);
+        checksum += rgb[0];
+        if (frame >= warmup)
+          latency += std::chrono::duration<double, std::milli>(Clock::now() - drawn.back()).count();
+      }
+      else
+        capture.capture(target.id, width, height);
+      glFlush();
+      if (frame >= warmup)
+        times.push_back(std::chrono::duration<double, std::milli>(Clock::now() - t0).count());
+    }
+    capture.flush();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    check_gl_error();
+
+    double mean = 0;
+    for (size_t i = 0; i < times.size(); ++i)
+      mean += times[i];
+    mean /= times.size();
+    std::sort(times.begin(), times.end());
+    double p99 = times[std::min(times.size() - 1, times.size() * 99 / 100)];
+    char name[16];
+    snprintf(name, sizeof(name), buffers == 0 ? "sync" : "ring %d", buffers);
+    printf("%-8s %10.3f %10.3f %10.1f %8u %12.3f\n", name, mean, p99, frames / seconds, capture.stalls,
+           latency / frames);
+    capture.free();
+  }
+
+  VBO.free();
+  VAO.free();
+  target.free();
+  program.free();
+  glfwTerminate();
+  return 0;
+}
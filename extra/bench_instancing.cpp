@@ -0,0 +1,187 @@
+// Instanced rendering stress benchmark
+//
+// Usage: bench_instancing [mesh.off] [counts...]
+//
+// Draws a grid of copies of the mesh (../data/bunny.off by default) with a
+// single glDrawElementsInstanced call for each instance count (10k to 100k
+// by default) and reports the frame time. Every count is measured twice:
+// with static instances and with all transforms rewritten every frame,
+// which adds the cost of the bulk update and upload.
+
+#include "Helpers.h"
+#include "InstanceBuffer.h"
+#include "Mesh.h"
+
+#include <GLFW/glfw3.h>
+#include <Eigen/Geometry>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+static const char *vertexShader =
+  "#version 150 core\n"
+  "in vec3 position;"
+  "in mat4 instance;"
+  "uniform mat4 projection;"
+  "out vec3 Color;"
+  "void main()"
+  "{"
+  "    Color = position * position;"
+  "    gl_Position = projection * instance * vec4(position, 1.0);"
+  "}";
+
+static const char *fragmentShader =
+  "#version 150 core\n"
+  "in vec3 Color;"
+  "out vec4 outColor;"
+  "void main()"
+  "{"
+  "    outColor = vec4(Color + 0.2, 1.0);"
+  "}";
+
+// Grid of count turned copies filling the cube [-1, 1]^3, spun by angle
+static void placeGrid(unsigned int count, float angle, std::vector<InstanceBuffer::Transform> &out)
+{
+  int side = (int) std::ceil(std::cbrt((double) count));
+  float scale = 1.0f / side;
+  out.resize(count);
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    Eigen::Vector3f cell((float) (i % side), (float) (i / side % side), (float) (i / (side * side)));
+    Eigen::Affine3f t = Eigen::Translation3f((cell * 2 + Eigen::Vector3f::Ones()) * scale - Eigen::Vector3f::Ones())
+                      * Eigen::AngleAxisf(angle + 0.7f * i, Eigen::Vector3f::UnitY())
+                      * Eigen::Scaling(scale);
+    out[i] = t.matrix();
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  const char *path = argc > 1 ? argv[1] : "../data/bunny.off";
+  std::vector<unsigned int> counts;
+  for (int i = 2; i < argc; ++i)
+    counts.push_back(atoi(argv[i]));
+  if (counts.empty())
+  {
+    const unsigned int defaults[] = { 10000, 25000, 50000, 100000 };
+    counts.assign(defaults, defaults + 4);
+  }
+
+  OffMesh mesh;
+  if (!loadOFF(path, mesh))
+    return -1;
+
+  // Fit the mesh into the unit cube around the origin
+  Eigen::Vector3f lo = mesh.V.rowwise().minCoeff(), hi = mesh.V.rowwise().maxCoeff();
+  float extent = (hi - lo).maxCoeff();
+  Eigen::MatrixXf V = ((mesh.V.colwise() - (lo + hi) / 2) / (extent > 0 ? extent : 1)) * 2;
+
+  if (!glfwInit())
+    return -1;
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+  glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+#ifdef __APPLE__
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+  GLFWwindow *window = glfwCreateWindow(1024, 768, "bench_instancing", NULL, NULL);
+  if (!window)
+  {
+    glfwTerminate();
+    return -1;
+  }
+  glfwMakeContextCurrent(window);
+  glfwSwapInterval(0);
+#ifndef __APPLE__
+  glewExperimental = true;
+  if (glewInit() != GLEW_OK)
+  {
+    std::cerr << "Cannot initialize GLEW" << std::endl;
+    return -1;
+  }
+  glGetError();
+#endif
+
+  Program program;
+  if (!program.init(vertexShader, fragmentShader, "outColor"))
+    return -1;
+  program.bind();
+  Eigen::Matrix4f projection = Eigen::Matrix4f::Identity();
+  projection(2, 2) = -1;
+  glUniformMatrix4fv(program.uniform("projection"), 1, GL_FALSE, projection.data());
+
+  VertexArrayObject VAO;
+  VAO.init();
+  VAO.bind();
+  VertexBufferObject VBO;
+  VBO.init();
+  VBO.update(V);
+  GLint position = program.attrib("position");
+  glEnableVertexAttribArray(position);
+  glVertexAttribPointer(position, 3, GL_FLOAT, GL_FALSE, 0, 0);
+  IndexBufferObject EBO;
+  EBO.init();
+  EBO.update(mesh.F.data(), (GLsizei) mesh.F.size(), (GLuint) V.cols());
+
+  InstanceBuffer instances;
+  instances.init();
+  instances.upload();
+  instances.attach(program.attrib("instance"));
+
+  glEnable(GL_DEPTH_TEST);
+  const int warmup = 5, frames = 50;
+  std::vector<InstanceBuffer::Transform> transforms;
+  std::vector<GLuint> handles;
+
+  printf("%s: %u triangles per instance\n", path, (unsigned) mesh.F.size() / 3);
+  printf("%10s %14s %14s %12s\n", "instances", "static ms", "updated ms", "Mtris/s");
+  for (size_t c = 0; c < counts.size(); ++c)
+  {
+    placeGrid(counts[c], 0, transforms);
+    handles.resize(counts[c]);
+    instances.clear();
+    instances.add(transforms.data(), transforms.size(), handles.data());
+
+    double ms[2];
+    for (int animate = 0; animate < 2; ++animate)
+    {
+      std::chrono::high_resolution_clock::time_point t0;
+      for (int frame = 0; frame < warmup + frames; ++frame)
+      {
+        if (frame == warmup)
+        {
+          glFinish();
+          t0 = std::chrono::high_resolution_clock::now();
+        }
+        if (animate)
+        {
+          placeGrid(counts[c], frame * 0.01f, transforms);
+          instances.update(handles.data(), transforms.data(), transforms.size());
+        }
+        instances.upload();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        EBO.drawInstanced(0, EBO.count, (GLsizei) instances.size());
+        glfwSwapBuffers(window);
+      }
+      glFinish();
+      std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+      ms[animate] = std::chrono::duration<double, std::milli>(t1 - t0).count() / frames;
+    }
+    check_gl_error();
+
+    printf("%10u %14.3f %14.3f %12.1f\n", counts[c], ms[0], ms[1],
+           counts[c] * (mesh.F.size() / 3) / (ms[0] * 1000.0));
+  }
+
+  instances.free();
+  EBO.free();
+  VBO.free();
+  VAO.free();
+  program.free();
+  glfwTerminate();
+  return 0;
+}
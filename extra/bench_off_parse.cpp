@@ -0,0 +1,101 @@
+// OFF parsing throughput benchmark
+//
+// Usage: bench_off_parse [faces] [file]
+//
+// Writes a synthetic grid mesh with the given number of triangles (10M by
+// default) to file, then loads it with 1, 2, 4, ... up to all hardware
+// threads and reports the throughput in MB/s. Every run is checked to
+// produce exactly the same buffers as the single threaded one.
+
+#include "Mesh.h"
+#include "ThreadPool.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+// Write a (n+1)x(n+1) vertex grid with 2*n*n triangles
+static bool writeGrid(const char *path, long faces)
+{
+  long n = (long) std::ceil(std::sqrt(faces / 2.0));
+  FILE *f = fopen(path, "w");
+  if (!f)
+    return false;
+  fprintf(f, "OFF\n%ld %ld 0\n", (n + 1) * (n + 1), 2 * n * n);
+  for (long y = 0; y <= n; ++y)
+    for (long x = 0; x <= n; ++x)
+      fprintf(f, "%.6f %.6f %.6f\n", x / (double) n, y / (double) n,
+              0.05 * std::sin(x * 0.1) * std::cos(y * 0.1));
+  for (long y = 0; y < n; ++y)
+    for (long x = 0; x < n; ++x)
+    {
+      long i = y * (n + 1) + x;
+      fprintf(f, "3 %ld %ld %ld\n3 %ld %ld %ld\n", i, i + 1, i + n + 2, i, i + n + 2, i + n + 1);
+    }
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  long faces = argc > 1 ? atol(argv[1]) : 10000000;
+  const char *path = argc > 2 ? argv[2] : "bench_grid.off";
+
+  std::cout << "Writing " << path << "..." << std::endl;
+  if (!writeGrid(path, faces))
+  {
+    std::cerr << "Cannot write " << path << std::endl;
+    return -1;
+  }
+
+  MappedFile file;
+  file.open(path);
+  double megabytes = file.size / (1024.0 * 1024.0);
+  file.close();
+
+  unsigned int maxThreads = std::thread::hardware_concurrency();
+  if (maxThreads == 0)
+    maxThreads = 1;
+
+  uint64_t reference = 0;
+  double baseline = 0;
+  for (unsigned int threads = 1; ; threads *= 2)
+  {
+    if (threads > maxThreads)
+      threads = maxThreads;
+
+    ThreadPool pool(threads);
+    OffMesh mesh;
+
+    // Best of three to hide page cache and scheduling noise
+    double best = 1e30;
+    for (int run = 0; run < 3; ++run)
+    {
+      std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+      if (!loadOFF(path, mesh, &pool))
+        return -1;
+      std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+      best = std::min(best, std::chrono::duration<double>(t1 - t0).count());
+    }
+
+    uint64_t hash = hashBytes(mesh.V.data(), sizeof(float) * mesh.V.size());
+    hash = hashBytes(mesh.F.data(), sizeof(unsigned int) * mesh.F.size(), hash);
+    if (threads == 1)
+    {
+      reference = hash;
+      baseline = best;
+    }
+
+    printf("%3u threads: %8.1f ms %8.1f MB/s  speedup %5.2fx %s\n", threads, best * 1000,
+           megabytes / best, baseline / best, hash == reference ? "" : "MISMATCH");
+
+    if (threads == maxThreads)
+      break;
+  }
+
+  remove(path);
+  return 0;
+}
@@ -0,0 +1,101 @@
+// Software rasterizer scaling benchmark
+//
+// Usage: bench_software [triangles] [width] [height] [frames]
+//
+// Draws a turning sphere with the given number of triangles (1M by
+// default) at 1920x1080 for 30 frames with 1, 2, 4, ... up to all hardware
+// threads, filled and as wireframe, and reports the frame time, the split
+// between setup and rasterization, and the speedup over one thread.
+
+#include "SoftwareRasterizer.h"
+#include "ThreadPool.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+// A UV sphere of radius 0.8 with about the requested number of triangles,
+// colored by position
+static void makeSphere(long triangles, Eigen::MatrixXf &V, std::vector<unsigned int> &F)
+{
+  int n = std::max(4, (int) std::sqrt(triangles / 2.0));
+  V.resize(6, (n + 1) * (n + 1));
+  for (int j = 0; j <= n; ++j)
+    for (int i = 0; i <= n; ++i)
+    {
+      float theta = 3.14159265f * j / n, phi = 2 * 3.14159265f * i / n;
+      Eigen::Vector3f p(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+      V.col(j * (n + 1) + i) << 0.8f * p, 0.5f * p + Eigen::Vector3f::Constant(0.5f);
+    }
+  F.clear();
+  for (int j = 0; j < n; ++j)
+    for (int i = 0; i < n; ++i)
+    {
+      unsigned int a = j * (n + 1) + i, b = a + 1, c = a + n + 1, d = c + 1;
+      unsigned int quad[6] = { a, c, b, b, c, d };
+      F.insert(F.end(), quad, quad + 6);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+  long triangles = argc > 1 ? atol(argv[1]) : 1000000;
+  int width = argc > 2 ? atoi(argv[2]) : 1920;
+  int height = argc > 3 ? atoi(argv[3]) : 1080;
+  int frames = argc > 4 ? atoi(argv[4]) : 30;
+
+  Eigen::MatrixXf V;
+  std::vector<unsigned int> F;
+  makeSphere(triangles, V, F);
+  PackedVertices packed;
+  packVertices(V.data(), V.rows(), V.cols(), VERTEX_FLOAT, packed);
+  SoftwareMesh mesh;
+  mesh.init(packed, F.data(), F.size());
+  printf("%zu triangles at %dx%d, %d frames\n", F.size() / 3, width, height, frames);
+
+  unsigned int maxThreads = std::thread::hardware_concurrency();
+  if (maxThreads == 0)
+    maxThreads = 1;
+  printf("%-10s %8s %10s %10s %10s %8s %8s\n", "mode", "threads", "frame ms", "setup ms", "raster ms", "fps",
+         "speedup");
+  for (int wireframe = 0; wireframe < 2; ++wireframe)
+  {
+    double single = 0;
+    for (unsigned int threads = 1;; threads = std::min(2 * threads, maxThreads))
+    {
+      ThreadPool pool(threads);
+      SoftwareRasterizer rasterizer(&pool);
+      rasterizer.resize(width, height);
+      rasterizer.wireframe = wireframe != 0;
+
+      std::chrono::high_resolution_clock::time_point start;
+      for (int frame = -2; frame < frames; ++frame)
+      {
+        // Two warm up frames size the buffers
+        if (frame == 0)
+        {
+          rasterizer.resetStats();
+          start = std::chrono::high_resolution_clock::now();
+        }
+        float angle = frame * 0.05f, aspect = float(height) / width;
+        Eigen::Matrix4f transform;
+        transform << aspect * std::cos(angle), 0, aspect * std::sin(angle), 0,
+                     0, 1, 0, 0,
+                     -0.5f * std::sin(angle), 0, 0.5f * std::cos(angle), 0,
+                     0, 0, 0, 1;
+        rasterizer.clear();
+        rasterizer.draw(mesh, transform);
+      }
+      double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / frames;
+      if (threads == 1)
+        single = ms;
+      printf("%-10s %8u %10.2f %10.2f %10.2f %8.1f %7.2fx\n", wireframe ? "wireframe" : "fill", threads, ms,
+             1000 * rasterizer.setupSeconds / frames, 1000 * rasterizer.rasterSeconds / frames, 1000 / ms, single / ms);
+      if (threads == maxThreads)
+        break;
+    }
+  }
+  return 0;
+}
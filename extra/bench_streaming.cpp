@@ -0,0 +1,185 @@
+// Dynamic vertex upload benchmark
+//
+// Usage: bench_streaming [megabytes per frame] [frames]
+//
+// Rewrites a cloud of points every frame (4 MB and 200 frames by default)
+// and draws it, comparing four ways of getting the data to the GPU:
+// - realloc:    glBufferData on every frame, reallocating the storage
+// - subdata:    VertexBufferObject::update, keeping the storage
+// - orphan:     StreamingBuffer mapping unsynchronized and orphaning on wrap
+// - persistent: StreamingBuffer mapped once and fenced (ARB_buffer_storage)
+// and reports the upload bandwidth and the spread of the frame times.
+
+#include "Helpers.h"
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+static const char *vertexShader =
+  "#version 150 core\n"
+  "in vec3 position;"
+  "out vec3 Color;"
+  "void main()"
+  "{"
+  "    Color = abs(position);"
+  "    gl_Position = vec4(position, 1.0);"
+  "}";
+
+static const char *fragmentShader =
+  "#version 150 core\n"
+  "in vec3 Color;"
+  "out vec4 outColor;"
+  "void main()"
+  "{"
+  "    outColor = vec4(Color, 1.0);"
+  "}";
+
+enum Method { REALLOC, SUBDATA, ORPHAN, PERSISTENT };
+static const char *methodNames[] = { "realloc", "subdata", "orphan", "persistent" };
+
+// Points on a spiral that turns a little every frame
+static void animate(Eigen::MatrixXf &V, int frame)
+{
+  for (int i = 0; i < V.cols(); ++i)
+  {
+    float t = (float) i / V.cols();
+    float a = 50 * t + frame * 0.05f;
+    V.col(i) << t * std::cos(a), t * std::sin(a), 0;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  double megabytes = argc > 1 ? atof(argv[1]) : 4;
+  int frames = argc > 2 ? atoi(argv[2]) : 200;
+  const int warmup = 10;
+
+  if (!glfwInit())
+    return -1;
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+  glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+#ifdef __APPLE__
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+  GLFWwindow *window = glfwCreateWindow(512, 512, "bench_streaming", NULL, NULL);
+  if (!window)
+  {
+    glfwTerminate();
+    return -1;
+  }
+  glfwMakeContextCurrent(window);
+  glfwSwapInterval(0);
+#ifndef __APPLE__
+  glewExperimental = true;
+  if (glewInit() != GLEW_OK)
+  {
+    std::cerr << "Cannot initialize GLEW" << std::endl;
+    return -1;
+  }
+  glGetError();
+#endif
+
+  Program program;
+  if (!program.init(vertexShader, fragmentShader, "outColor"))
+    return -1;
+  program.bind();
+  GLint position = program.attrib("position");
+
+  VertexArrayObject VAO;
+  VAO.init();
+  VAO.bind();
+  glEnableVertexAttribArray(position);
+
+  size_t points = std::max<size_t>(1, (size_t) (megabytes * (1 << 20) / (3 * sizeof(float))));
+  Eigen::MatrixXf V(3, points);
+  size_t bytes = V.size() * sizeof(float);
+
+  printf("%zu points, %.2f MB per frame, %d frames\n", points, bytes / double(1 << 20), frames);
+  printf("%-12s %10s %10s %10s %10s %8s\n", "method", "MB/s", "mean ms", "stddev ms", "p99 ms", "stalls");
+  for (int method = REALLOC; method <= PERSISTENT; ++method)
+  {
+#ifdef __APPLE__
+    if (method == PERSISTENT)
+      continue;
+#else
+    if (method == PERSISTENT && !GLEW_ARB_buffer_storage)
+    {
+      printf("%-12s %10s\n", methodNames[method], "unsupported");
+      continue;
+    }
+#endif
+    VertexBufferObject VBO;
+    StreamingBuffer ring;
+    if (method == REALLOC || method == SUBDATA)
+      VBO.init();
+    else
+      ring.init(3 * bytes, GL_ARRAY_BUFFER,
+                method == ORPHAN ? StreamingBuffer::STREAM_ORPHAN : StreamingBuffer::STREAM_PERSISTENT);
+
+    std::vector<double> times;
+    double uploadSeconds = 0;
+    for (int frame = 0; frame < warmup + frames; ++frame)
+    {
+      animate(V, frame);
+      std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+
+      size_t offset = 0;
+      if (method == REALLOC)
+      {
+        glBindBuffer(GL_ARRAY_BUFFER, VBO.id);
+        glBufferData(GL_ARRAY_BUFFER, bytes, V.data(), GL_DYNAMIC_DRAW);
+      }
+      else if (method == SUBDATA)
+        VBO.update(V);
+      else
+        offset = ring.write(V.data(), bytes);
+      std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+
+      glVertexAttribPointer(position, 3, GL_FLOAT, GL_FALSE, 0, (void*) offset);
+      glClear(GL_COLOR_BUFFER_BIT);
+      glDrawArrays(GL_POINTS, 0, (GLsizei) points);
+      if (method == ORPHAN || method == PERSISTENT)
+        ring.fence();
+      glfwSwapBuffers(window);
+      std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
+
+      if (frame >= warmup)
+      {
+        uploadSeconds += std::chrono::duration<double>(t1 - t0).count();
+        times.push_back(std::chrono::duration<double, std::milli>(t2 - t0).count());
+      }
+    }
+    glFinish();
+    check_gl_error();
+
+    double mean = 0, variance = 0;
+    for (size_t i = 0; i < times.size(); ++i)
+      mean += times[i];
+    mean /= times.size();
+    for (size_t i = 0; i < times.size(); ++i)
+      variance += (times[i] - mean) * (times[i] - mean);
+    std::sort(times.begin(), times.end());
+    double p99 = times[std::min(times.size() - 1, times.size() * 99 / 100)];
+    printf("%-12s %10.1f %10.3f %10.3f %10.3f %8zu\n", methodNames[method],
+           bytes * (double) frames / (1 << 20) / uploadSeconds, mean, std::sqrt(variance / times.size()), p99,
+           ring.stalls);
+
+    if (method == REALLOC || method == SUBDATA)
+      VBO.free();
+    else
+      ring.free();
+  }
+
+  VAO.free();
+  program.free();
+  glfwTerminate();
+  return 0;
+}
@@ -0,0 +1,147 @@
+#include "FrameCapture.h"
+#include "GLState.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstring>
+
+void CapturedFrame::copyRGB(std::vector<unsigned char> &rgb) const
+{
+  rgb.resize(size_t(width) * height * 3);
+  unsigned char *out = rgb.data();
+  for (int y = height - 1; y >= 0; --y)
+  {
+    const unsigned char *in = pixels + size_t(y) * width * 4;
+    for (int x = 0; x < width; ++x, in += 4, out += 3)
+    {
+      out[0] = in[0];
+      out[1] = in[1];
+      out[2] = in[2];
+    }
+  }
+}
+
+FrameCapture::FrameCapture() : captured(0), delivered(0), stalls(0), buffers(3), next(0), width(0), height(0)
+{
+}
+
+void FrameCapture::init(unsigned int buffers)
+{
+  free();
+  this->buffers = std::min(std::max(buffers, 2u), 4u);
+  captured = delivered = stalls = 0;
+}
+
+void FrameCapture::allocate(int width, int height)
+{
+  ring.resize(buffers);
+  glGenBuffers((GLsizei) ring.size(), ring.data());
+  for (size_t i = 0; i < ring.size(); ++i)
+  {
+    glState.bindBuffer(GL_PIXEL_PACK_BUFFER, ring[i]);
+    glBufferData(GL_PIXEL_PACK_BUFFER, size_t(width) * height * 4, NULL, GL_STREAM_READ);
+  }
+  glState.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  this->width = width;
+  this->height = height;
+  next = 0;
+  check_gl_error();
+}
+
+void FrameCapture::capture(GLuint framebuffer, int width, int height)
+{
+  TRACE_SCOPE("capture");
+  if (width <= 0 || height <= 0)
+    return;
+  if (width != this->width || height != this->height || ring.empty())
+  {
+    // Frames already read keep their old size, deliver them first
+    free();
+    allocate(width, height);
+  }
+
+  // The next buffer is free once the ring has room
+  if (pending.size() == ring.size())
+    deliver(true);
+
+  // RGBA rows are 4 byte aligned and copied without conversion by most
+  // drivers, the copy runs on the GPU and lands in the buffer
+  Pending frame;
+  frame.frame = captured++;
+  frame.buffer = ring[next];
+  next = (next + 1) % ring.size();
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+  if (framebuffer == 0)
+    glReadBuffer(GL_BACK);
+  glState.bindBuffer(GL_PIXEL_PACK_BUFFER, frame.buffer);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+
+  // Reads into client memory elsewhere must not land in the buffer
+  glState.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  frame.sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  pending.push_back(frame);
+  check_gl_error();
+
+  // Frames two captures old are mapped if the GPU is done with them
+  while (!pending.empty() && captured - pending.front().frame > 2)
+    if (!deliver(false))
+      break;
+}
+
+bool FrameCapture::deliver(bool block)
+{
+  Pending frame = pending.front();
+  if (glClientWaitSync(frame.sync, 0, 0) == GL_TIMEOUT_EXPIRED)
+  {
+    if (!block)
+      return false;
+    TRACE_SCOPE("capture stall");
+    ++stalls;
+    while (glClientWaitSync(frame.sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+      ;
+  }
+  glDeleteSync(frame.sync);
+  pending.pop_front();
+
+  glState.bindBuffer(GL_PIXEL_PACK_BUFFER, frame.buffer);
+  size_t size = size_t(width) * height * 4;
+  const unsigned char *pixels = (const unsigned char *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+  if (pixels)
+  {
+    if (consumer)
+    {
+      CapturedFrame view;
+      view.frame = frame.frame;
+      view.width = width;
+      view.height = height;
+      view.pixels = pixels;
+      consumer(view);
+    }
+    ++delivered;
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glState.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  check_gl_error();
+  return true;
+}
+
+void FrameCapture::flush()
+{
+  while (!pending.empty())
+    deliver(true);
+}
+
+void FrameCapture::free()
+{
+  flush();
+  if (!ring.empty())
+  {
+    glDeleteBuffers((GLsizei) ring.size(), ring.data());
+    for (size_t i = 0; i < ring.size(); ++i)
+      glState.forgetBuffer(ring[i]);
+  }
+  ring.clear();
+  width = height = 0;
+  next = 0;
+}
@@ -0,0 +1,101 @@
+#ifndef FRAMECAPTURE_H
+#define FRAMECAPTURE_H
+
+#include "Helpers.h"
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+// Pixels of one captured frame as RGBA rows from bottom to top, the order
+// GL reads them in. They point into a mapped pixel buffer and are only
+// valid during the consumer callback.
+class CapturedFrame
+{
+public:
+  // Number of the frame, counting every call to FrameCapture::capture
+  unsigned int frame;
+  int width;
+  int height;
+  const unsigned char *pixels;
+
+  // Copy the pixels as RGB rows from top to bottom, the order of
+  // FrameBufferObject::read and writeImage
+  void copyRGB(std::vector<unsigned char> &rgb) const;
+};
+
+// Reads frames back through a ring of pixel pack buffers without waiting
+// for the GPU. capture queues the copy of a framebuffer into the next
+// buffer with a fence, and each frame is mapped two captures later, by
+// which time the GPU has normally finished it. A frame that is not ready
+// yet waits for a later capture while the ring has room; only a full ring
+// blocks, which is counted as a stall.
+//
+// Usage
+//   capture.consumer = [](const CapturedFrame &frame) { ... };
+//   capture.init(3);
+//   // every frame, after drawing and before swapping
+//   capture.capture(0, width, height);
+//   ...
+//   capture.flush();
+class FrameCapture
+{
+public:
+  typedef unsigned int GLuint;
+  typedef std::function<void(const CapturedFrame &)> Consumer;
+
+  // Called with every frame read back, in order
+  Consumer consumer;
+
+  // Frames captured, delivered to the consumer, and deliveries that had
+  // to wait for the GPU
+  unsigned int captured;
+  unsigned int delivered;
+  unsigned int stalls;
+
+  FrameCapture();
+
+  // Use a ring of 2 to 4 buffers. Two always map a frame two captures
+  // later, more let a late frame wait without blocking.
+  void init(unsigned int buffers = 3);
+
+  // Queue the read back of the color buffer of framebuffer, 0 for the
+  // window's back buffer, and hand the frames that are ready to the
+  // consumer. A new size drains the ring and resizes its buffers.
+  void capture(GLuint framebuffer, int width, int height);
+
+  // Wait for the GPU and hand every pending frame to the consumer
+  void flush();
+
+  // Flush and release the buffers
+  void free();
+
+private:
+  FrameCapture(const FrameCapture &);
+  FrameCapture &operator=(const FrameCapture &);
+
+  // A frame read back into buffer and not delivered yet
+  class Pending
+  {
+  public:
+    unsigned int frame;
+    GLuint buffer;
+    GLsync sync;
+  };
+
+  // Map the oldest pending frame, waiting for it if block is set, and
+  // hand it to the consumer. False if it was not ready.
+  bool deliver(bool block);
+
+  // Create the ring for frames of width x height
+  void allocate(int width, int height);
+
+  unsigned int buffers;
+  std::vector<GLuint> ring;
+  std::deque<Pending> pending;
+  unsigned int next;
+  int width;
+  int height;
+};
+
+#endif
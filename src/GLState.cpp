@@ -0,0 +1,190 @@
+#include "GLState.h"
+
+GLState glState;
+
+namespace
+{
+  // Stands for a value not known to the tracker
+  const unsigned int unknown = ~0u;
+
+  const GLenum trackedBuffers[] = {
+    GL_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+    GL_PIXEL_PACK_BUFFER, GL_PIXEL_UNPACK_BUFFER
+  };
+
+  const GLenum trackedCapabilities[] = {
+    GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND, GL_SCISSOR_TEST, GL_STENCIL_TEST,
+    GL_POLYGON_OFFSET_FILL, GL_MULTISAMPLE
+  };
+}
+
+GLState::GLState() : calls(0), skipped(0)
+{
+  invalidate();
+}
+
+int GLState::bufferSlot(GLenum target)
+{
+  for (int i = 0; i < bufferTargets; ++i)
+    if (trackedBuffers[i] == target)
+      return i;
+  return -1;
+}
+
+int GLState::capabilitySlot(GLenum capability)
+{
+  for (int i = 0; i < capabilities; ++i)
+    if (trackedCapabilities[i] == capability)
+      return i;
+  return -1;
+}
+
+bool GLState::change(bool changes)
+{
+  ++calls;
+  if (!changes)
+    ++skipped;
+  return changes;
+}
+
+void GLState::useProgram(GLuint program)
+{
+  if (!change(this->program != program))
+    return;
+  glUseProgram(program);
+  this->program = program;
+}
+
+void GLState::bindVertexArray(GLuint vertexArray)
+{
+  if (!change(this->vertexArray != vertexArray))
+    return;
+  glBindVertexArray(vertexArray);
+  this->vertexArray = vertexArray;
+}
+
+void GLState::bindBuffer(GLenum target, GLuint buffer)
+{
+  int slot = bufferSlot(target);
+  if (!change(slot < 0 || buffers[slot] != buffer))
+    return;
+  glBindBuffer(target, buffer);
+  if (slot >= 0)
+    buffers[slot] = buffer;
+}
+
+void GLState::bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+  // Indexed bindings are not tracked, only their effect on the generic one
+  change(true);
+  glBindBufferBase(target, index, buffer);
+  int slot = bufferSlot(target);
+  if (slot >= 0)
+    buffers[slot] = buffer;
+}
+
+void GLState::bindBufferRange(GLenum target, GLuint index, GLuint buffer, size_t offset, size_t size)
+{
+  change(true);
+  glBindBufferRange(target, index, buffer, (GLintptr) offset, (GLsizeiptr) size);
+  int slot = bufferSlot(target);
+  if (slot >= 0)
+    buffers[slot] = buffer;
+}
+
+void GLState::setEnabled(GLenum capability, bool enabled)
+{
+  int slot = capabilitySlot(capability);
+  if (!change(slot < 0 || this->enabled[slot] != (int) enabled))
+    return;
+  if (enabled)
+    glEnable(capability);
+  else
+    glDisable(capability);
+  if (slot >= 0)
+    this->enabled[slot] = enabled;
+}
+
+void GLState::enable(GLenum capability)
+{
+  setEnabled(capability, true);
+}
+
+void GLState::disable(GLenum capability)
+{
+  setEnabled(capability, false);
+}
+
+bool GLState::isEnabled(GLenum capability) const
+{
+  int slot = capabilitySlot(capability);
+  return slot >= 0 && enabled[slot] == 1;
+}
+
+GLenum GLState::currentPolygonMode() const
+{
+  return polygon == unknown ? 0 : polygon;
+}
+
+void GLState::polygonMode(GLenum mode)
+{
+  if (!change(polygon != mode))
+    return;
+  glPolygonMode(GL_FRONT_AND_BACK, mode);
+  polygon = mode;
+}
+
+void GLState::blendFunc(GLenum source, GLenum destination)
+{
+  if (!change(blendSource != source || blendDestination != destination))
+    return;
+  glBlendFunc(source, destination);
+  blendSource = source;
+  blendDestination = destination;
+}
+
+void GLState::blendEquation(GLenum mode)
+{
+  if (!change(equation != mode))
+    return;
+  glBlendEquation(mode);
+  equation = mode;
+}
+
+void GLState::forgetProgram(GLuint program)
+{
+  if (this->program == program)
+    this->program = unknown;
+}
+
+void GLState::forgetVertexArray(GLuint vertexArray)
+{
+  if (this->vertexArray == vertexArray)
+    this->vertexArray = unknown;
+}
+
+void GLState::forgetBuffer(GLuint buffer)
+{
+  for (int i = 0; i < bufferTargets; ++i)
+    if (buffers[i] == buffer)
+      buffers[i] = unknown;
+}
+
+void GLState::invalidate()
+{
+  program = unknown;
+  vertexArray = unknown;
+  for (int i = 0; i < bufferTargets; ++i)
+    buffers[i] = unknown;
+  for (int i = 0; i < capabilities; ++i)
+    enabled[i] = -1;
+  polygon = unknown;
+  blendSource = blendDestination = unknown;
+  equation = unknown;
+}
+
+void GLState::resetCounts()
+{
+  calls = 0;
+  skipped = 0;
+}
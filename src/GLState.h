@@ -0,0 +1,89 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include "Helpers.h"
+
+// Shadow copy of the GL state the viewer changes most often: the program,
+// the VAO, the generic buffer bindings, the common capabilities, the polygon
+// mode and the blend setup. Each call is skipped when it would not change
+// the state, and counted either way. All state starts unknown, so the first
+// call of each kind always reaches the driver.
+//
+// The tracker only knows about changes made through it. Code that changes
+// the same state with plain GL calls must call invalidate() afterwards.
+class GLState
+{
+public:
+  typedef unsigned int GLuint;
+  typedef unsigned int GLenum;
+
+  // Calls made through the tracker and the part of them skipped
+  size_t calls;
+  size_t skipped;
+
+  GLState();
+
+  void useProgram(GLuint program);
+  void bindVertexArray(GLuint vertexArray);
+
+  // Bind a buffer to a generic target. GL_ELEMENT_ARRAY_BUFFER is part of
+  // the VAO and is never skipped.
+  void bindBuffer(GLenum target, GLuint buffer);
+
+  // Bind a buffer or a range of it to an indexed target, which also sets
+  // the generic one
+  void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+  void bindBufferRange(GLenum target, GLuint index, GLuint buffer, size_t offset, size_t size);
+
+  void enable(GLenum capability);
+  void disable(GLenum capability);
+  void polygonMode(GLenum mode);
+  void blendFunc(GLenum source, GLenum destination);
+  void blendEquation(GLenum mode);
+
+  // Whether a capability is known to be enabled, false if it is unknown
+  bool isEnabled(GLenum capability) const;
+
+  // The polygon mode last set through the tracker, 0 if it is unknown
+  GLenum currentPolygonMode() const;
+
+  // Drop objects that are deleted, GL unbinds them and may reuse the names
+  void forgetProgram(GLuint program);
+  void forgetVertexArray(GLuint vertexArray);
+  void forgetBuffer(GLuint buffer);
+
+  // Forget everything, e.g. after GL calls made around the tracker
+  void invalidate();
+
+  // Restart the call counts
+  void resetCounts();
+
+private:
+  // Slot of a tracked target or capability, -1 if it is not tracked
+  static int bufferSlot(GLenum target);
+  static int capabilitySlot(GLenum capability);
+
+  // Count a call, true if it changes the state
+  bool change(bool changes);
+
+  void setEnabled(GLenum capability, bool enabled);
+
+  static const int bufferTargets = 6;
+  static const int capabilities = 7;
+
+  GLuint program;
+  GLuint vertexArray;
+  GLuint buffers[bufferTargets];
+
+  // 1 enabled, 0 disabled, -1 unknown
+  int enabled[capabilities];
+
+  GLenum polygon;
+  GLenum blendSource, blendDestination;
+  GLenum equation;
+};
+
+// The state of the one context the viewer renders with
+extern GLState glState;
+
+#endif
@@ -0,0 +1,294 @@
+#include "GeometryArena.h"
+#include "GLState.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+RangeAllocator::RangeAllocator(size_t capacity) : capacity_(0), used_(0)
+{
+  reset(capacity);
+}
+
+bool RangeAllocator::allocate(size_t size, size_t &offset)
+{
+  if (size == 0)
+  {
+    offset = 0;
+    return true;
+  }
+  for (std::map<size_t, size_t>::iterator it = free_.begin(); it != free_.end(); ++it)
+  {
+    if (it->second < size)
+      continue;
+    offset = it->first;
+    size_t rest = it->second - size;
+    free_.erase(it);
+    if (rest > 0)
+      free_[offset + size] = rest;
+    used_ += size;
+    return true;
+  }
+  return false;
+}
+
+void RangeAllocator::release(size_t offset, size_t size)
+{
+  if (size == 0)
+    return;
+  used_ -= size;
+  std::map<size_t, size_t>::iterator next = free_.lower_bound(offset);
+
+  // Merge with the free range that ends where this one starts
+  if (next != free_.begin())
+  {
+    std::map<size_t, size_t>::iterator prev = next;
+    --prev;
+    if (prev->first + prev->second == offset)
+    {
+      offset = prev->first;
+      size += prev->second;
+      free_.erase(prev);
+    }
+  }
+
+  // And with the one that starts where it ends
+  if (next != free_.end() && offset + size == next->first)
+  {
+    size += next->second;
+    free_.erase(next);
+  }
+  free_[offset] = size;
+}
+
+void RangeAllocator::reset(size_t capacity)
+{
+  free_.clear();
+  capacity_ = capacity;
+  used_ = 0;
+  if (capacity > 0)
+    free_[0] = capacity;
+}
+
+size_t RangeAllocator::fragmented() const
+{
+  size_t total = capacity_ - used_;
+  if (!free_.empty())
+  {
+    std::map<size_t, size_t>::const_iterator last = --free_.end();
+    if (last->first + last->second == capacity_)
+      total -= last->second;
+  }
+  return total;
+}
+
+GeometryArena::GeometryArena()
+  : format(VERTEX_FLOAT), stride(0), vertexBuffer(0), indexBuffer(0)
+{
+}
+
+void GeometryArena::init(VertexFormat format, size_t vertices, size_t indices)
+{
+  this->format = format;
+  stride = vertexSize(format);
+  VAO.init();
+  meshes.clear();
+  freeHandles.clear();
+  vertexRanges.reset(0);
+  indexRanges.reset(0);
+  relocate(vertices, indices);
+}
+
+int GeometryArena::add(const PackedVertices &vertices, const GLuint *indices, GLsizei count)
+{
+  if (vertices.format != format)
+  {
+    std::cerr << "Cannot add " << vertexFormatName(vertices.format) << " vertices to an arena of "
+              << vertexFormatName(format) << " vertices" << std::endl;
+    return -1;
+  }
+
+  Allocation a;
+  a.vertexCount = vertices.count;
+  a.indexCount = count;
+  a.dequantize = vertices.dequantize;
+  a.live = true;
+
+  // Grow both buffers when either is full, which also packs them
+  bool hasVertices = vertexRanges.allocate(a.vertexCount, a.vertexOffset);
+  bool hasIndices = hasVertices && indexRanges.allocate(a.indexCount, a.indexOffset);
+  if (!hasIndices)
+  {
+    if (hasVertices)
+      vertexRanges.release(a.vertexOffset, a.vertexCount);
+    relocate(std::max(vertexRanges.capacity() * 2, vertexRanges.used() + a.vertexCount),
+             std::max(indexRanges.capacity() * 2, indexRanges.used() + a.indexCount));
+    bool placed = vertexRanges.allocate(a.vertexCount, a.vertexOffset)
+               && indexRanges.allocate(a.indexCount, a.indexOffset);
+    assert(placed);
+    (void) placed;
+  }
+
+  glState.bindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+  glBufferSubData(GL_ARRAY_BUFFER, a.vertexOffset * stride, a.vertexCount * stride, vertices.data);
+  glState.bindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, a.indexOffset * sizeof(GLuint), a.indexCount * sizeof(GLuint), indices);
+  check_gl_error();
+
+  int handle;
+  if (!freeHandles.empty())
+  {
+    handle = freeHandles.back();
+    freeHandles.pop_back();
+    meshes[handle] = a;
+  }
+  else
+  {
+    handle = (int) meshes.size();
+    meshes.push_back(a);
+  }
+  return handle;
+}
+
+void GeometryArena::remove(int handle)
+{
+  Allocation &a = meshes[handle];
+  assert(a.live);
+  vertexRanges.release(a.vertexOffset, a.vertexCount);
+  indexRanges.release(a.indexOffset, a.indexCount);
+  a.live = false;
+  freeHandles.push_back(handle);
+
+  if (vertexRanges.fragmented() * 4 > vertexRanges.capacity()
+      || indexRanges.fragmented() * 4 > indexRanges.capacity())
+    defragment();
+}
+
+void GeometryArena::defragment()
+{
+  relocate(vertexRanges.capacity(), indexRanges.capacity());
+}
+
+void GeometryArena::relocate(size_t vertexCapacity, size_t indexCapacity)
+{
+  GLuint vertices, indices;
+  glGenBuffers(1, &vertices);
+  glGenBuffers(1, &indices);
+  glState.bindBuffer(GL_COPY_WRITE_BUFFER, vertices);
+  glBufferData(GL_COPY_WRITE_BUFFER, vertexCapacity * stride, 0, GL_STATIC_DRAW);
+  glState.bindBuffer(GL_COPY_WRITE_BUFFER, indices);
+  glBufferData(GL_COPY_WRITE_BUFFER, indexCapacity * sizeof(GLuint), 0, GL_STATIC_DRAW);
+
+  // Copy the live meshes packed, keeping their order
+  std::vector<int> order;
+  for (size_t i = 0; i < meshes.size(); ++i)
+    if (meshes[i].live)
+      order.push_back((int) i);
+  std::sort(order.begin(), order.end(), [this](int a, int b) {
+    return meshes[a].vertexOffset < meshes[b].vertexOffset;
+  });
+
+  vertexRanges.reset(vertexCapacity);
+  indexRanges.reset(indexCapacity);
+  for (size_t i = 0; i < order.size(); ++i)
+  {
+    Allocation &a = meshes[order[i]];
+    size_t vertexOffset, indexOffset;
+    vertexRanges.allocate(a.vertexCount, vertexOffset);
+    indexRanges.allocate(a.indexCount, indexOffset);
+
+    glState.bindBuffer(GL_COPY_READ_BUFFER, vertexBuffer);
+    glState.bindBuffer(GL_COPY_WRITE_BUFFER, vertices);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, a.vertexOffset * stride,
+                        vertexOffset * stride, a.vertexCount * stride);
+    glState.bindBuffer(GL_COPY_READ_BUFFER, indexBuffer);
+    glState.bindBuffer(GL_COPY_WRITE_BUFFER, indices);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, a.indexOffset * sizeof(GLuint),
+                        indexOffset * sizeof(GLuint), a.indexCount * sizeof(GLuint));
+    a.vertexOffset = vertexOffset;
+    a.indexOffset = indexOffset;
+  }
+
+  if (vertexBuffer)
+  {
+    glDeleteBuffers(1, &vertexBuffer);
+    glState.forgetBuffer(vertexBuffer);
+  }
+  if (indexBuffer)
+  {
+    glDeleteBuffers(1, &indexBuffer);
+    glState.forgetBuffer(indexBuffer);
+  }
+  vertexBuffer = vertices;
+  indexBuffer = indices;
+  attach();
+  check_gl_error();
+}
+
+void GeometryArena::attach()
+{
+  VAO.bind();
+  glState.bindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+  if (setupAttributes)
+    setupAttributes(format);
+}
+
+void GeometryArena::bind()
+{
+  VAO.bind();
+}
+
+void GeometryArena::draw(int handle)
+{
+  const Allocation &a = meshes[handle];
+  glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei) a.indexCount, GL_UNSIGNED_INT,
+                           (void*)(a.indexOffset * sizeof(GLuint)), (GLint) a.vertexOffset);
+}
+
+void GeometryArena::draw(const int *handles, size_t count)
+{
+  counts.clear();
+  offsets.clear();
+  baseVertices.clear();
+  for (size_t i = 0; i < count; ++i)
+  {
+    const Allocation &a = meshes[handles[i]];
+    counts.push_back((GLsizei) a.indexCount);
+    offsets.push_back((const GLvoid*)(a.indexOffset * sizeof(GLuint)));
+    baseVertices.push_back((GLint) a.vertexOffset);
+  }
+  if (!counts.empty())
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT, offsets.data(),
+                                  (GLsizei) counts.size(), baseVertices.data());
+}
+
+size_t GeometryArena::capacityBytes() const
+{
+  return vertexRanges.capacity() * stride + indexRanges.capacity() * sizeof(GLuint);
+}
+
+size_t GeometryArena::usedBytes() const
+{
+  return vertexRanges.used() * stride + indexRanges.used() * sizeof(GLuint);
+}
+
+void GeometryArena::free()
+{
+  VAO.free();
+  if (vertexBuffer)
+  {
+    glDeleteBuffers(1, &vertexBuffer);
+    glState.forgetBuffer(vertexBuffer);
+  }
+  if (indexBuffer)
+  {
+    glDeleteBuffers(1, &indexBuffer);
+    glState.forgetBuffer(indexBuffer);
+  }
+  vertexBuffer = indexBuffer = 0;
+  meshes.clear();
+  freeHandles.clear();
+  vertexRanges.reset(0);
+  indexRanges.reset(0);
+}
@@ -0,0 +1,128 @@
+#ifndef GEOMETRYARENA_H
+#define GEOMETRYARENA_H
+
+#include "Helpers.h"
+#include "VertexFormat.h"
+
+#include <map>
+#include <vector>
+#include <functional>
+
+// First fit allocator of ranges in [0, capacity), merging neighbouring free
+// ranges when they are released
+class RangeAllocator
+{
+public:
+  explicit RangeAllocator(size_t capacity = 0);
+
+  // Find size free units, false if there is no hole large enough
+  bool allocate(size_t size, size_t &offset);
+
+  // Return a range obtained from allocate
+  void release(size_t offset, size_t size);
+
+  // Forget all allocations and make capacity units available
+  void reset(size_t capacity);
+
+  size_t capacity() const { return capacity_; }
+  size_t used() const { return used_; }
+
+  // Free units that lie in holes before the last allocation
+  size_t fragmented() const;
+
+private:
+  // Free ranges by offset
+  std::map<size_t, size_t> free_;
+  size_t capacity_;
+  size_t used_;
+};
+
+// Vertices and indices of many meshes in one vertex buffer and one index
+// buffer behind a single VAO. Indices are stored relative to their mesh and
+// drawn with a base vertex, so meshes can move within the buffers without
+// rewriting them. Growing and defragmenting copy the live meshes into
+// new buffers on the GPU.
+class GeometryArena
+{
+public:
+  typedef unsigned int GLuint;
+  typedef int GLint;
+  typedef int GLsizei;
+
+  // Placement of one mesh
+  class Allocation
+  {
+  public:
+    size_t vertexOffset, vertexCount;
+    size_t indexOffset, indexCount;
+    Eigen::Matrix<float, 4, 4, Eigen::DontAlign> dequantize;
+    bool live;
+  };
+
+  // Called with the VAO and the vertex buffer bound to set up the vertex
+  // attributes, whenever the vertex buffer is replaced
+  std::function<void(VertexFormat)> setupAttributes;
+
+  GeometryArena();
+
+  // Create the buffers for vertices in format with room for the given
+  // number of vertices and indices
+  void init(VertexFormat format, size_t vertices = 1 << 16, size_t indices = 1 << 18);
+
+  // Copy a mesh into the arena, growing it if needed. Returns a handle, or
+  // -1 if the vertices are in a different format.
+  int add(const PackedVertices &vertices, const GLuint *indices, GLsizei count);
+
+  // Release a mesh. Defragments once holes take a quarter of the buffers.
+  void remove(int handle);
+
+  // Move all meshes to the start of the buffers
+  void defragment();
+
+  const Allocation &mesh(int handle) const { return meshes[handle]; }
+
+  // Bind the VAO, which is all the state drawing any mesh needs
+  void bind();
+
+  // Draw one mesh, the arena must be bound
+  void draw(int handle);
+
+  // Draw count meshes with a single call, the arena must be bound
+  void draw(const int *handles, size_t count);
+
+  // GPU memory held by the buffers and used by meshes
+  size_t capacityBytes() const;
+  size_t usedBytes() const;
+
+  // Release the buffers and all meshes
+  void free();
+
+private:
+  GeometryArena(const GeometryArena &);
+  GeometryArena &operator=(const GeometryArena &);
+
+  // Replace the buffers by ones of the given capacity holding the live
+  // meshes packed at their start
+  void relocate(size_t vertexCapacity, size_t indexCapacity);
+
+  // Make the VAO use the current buffers
+  void attach();
+
+  VertexFormat format;
+  size_t stride;
+  VertexArrayObject VAO;
+  GLuint vertexBuffer;
+  GLuint indexBuffer;
+  RangeAllocator vertexRanges;
+  RangeAllocator indexRanges;
+
+  std::vector<Allocation> meshes;
+  std::vector<int> freeHandles;
+
+  // Scratch lists for batched draws
+  std::vector<GLsizei> counts;
+  std::vector<const GLvoid*> offsets;
+  std::vector<GLint> baseVertices;
+};
+
+#endif
@@ -0,0 +1,238 @@
+#include "GpuProfiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+GpuProfiler::GpuProfiler() : enabled(false), dropped(0), current(0), window(0)
+{
+}
+
+bool GpuProfiler::init(int latency, size_t window)
+{
+#ifdef __APPLE__
+  enabled = true;
+#else
+  enabled = GLEW_ARB_timer_query != 0;
+#endif
+  this->window = window;
+  frames.assign(std::max(latency, 1), Frame());
+  for (size_t i = 0; i < frames.size(); ++i)
+  {
+    frames[i].used = 0;
+    frames[i].pending = false;
+  }
+  current = 0;
+  dropped = 0;
+  nodes.clear();
+  open.clear();
+
+  // The frame scope is the root of all others
+  Node root;
+  root.name = "frame";
+  root.depth = 0;
+  nodes.push_back(root);
+  return enabled;
+}
+
+size_t GpuProfiler::timestamp()
+{
+  Frame &frame = frames[current];
+  if (frame.used == frame.queries.size())
+  {
+    GLuint query;
+    glGenQueries(1, &query);
+    frame.queries.push_back(query);
+  }
+  glQueryCounter(frame.queries[frame.used], GL_TIMESTAMP);
+  return frame.used++;
+}
+
+void GpuProfiler::collect(Frame &frame)
+{
+  if (!frame.pending)
+    return;
+  frame.pending = false;
+
+  // Queries complete in order, the last one tells if all are ready
+  GLint available = 0;
+  glGetQueryObjectiv(frame.queries[frame.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available)
+  {
+    ++dropped;
+    return;
+  }
+
+  std::vector<GLuint64> times(frame.used);
+  for (size_t i = 0; i < frame.used; ++i)
+    glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &times[i]);
+  for (size_t i = 0; i < frame.scopes.size(); ++i)
+  {
+    const Scope &scope = frame.scopes[i];
+    std::deque<double> &samples = nodes[scope.id].samples;
+    samples.push_back((times[scope.end] - times[scope.begin]) / 1e6);
+    if (samples.size() > window)
+      samples.pop_front();
+  }
+}
+
+void GpuProfiler::beginFrame()
+{
+  if (!enabled || frames.empty())
+    return;
+  Frame &frame = frames[current];
+  collect(frame);
+  frame.used = 0;
+  frame.scopes.clear();
+  open.clear();
+
+  Scope root;
+  root.id = 0;
+  root.begin = timestamp();
+  root.end = 0;
+  frame.scopes.push_back(root);
+  open.push_back(0);
+}
+
+void GpuProfiler::endFrame()
+{
+  if (!enabled || frames.empty() || open.empty())
+    return;
+
+  // Close scopes left open so the frame stays consistent
+  while (!open.empty())
+    end();
+  frames[current].pending = true;
+  current = (current + 1) % frames.size();
+}
+
+void GpuProfiler::begin(const char *name)
+{
+  if (!enabled || open.empty())
+    return;
+  Frame &frame = frames[current];
+  int parent = frame.scopes[open.back()].id;
+
+  std::map<std::string, int>::iterator it = nodes[parent].children.find(name);
+  int id;
+  if (it != nodes[parent].children.end())
+    id = it->second;
+  else
+  {
+    id = (int) nodes.size();
+    nodes[parent].children[name] = id;
+    Node node;
+    node.name = name;
+    node.depth = nodes[parent].depth + 1;
+    nodes.push_back(node);
+  }
+
+  Scope scope;
+  scope.id = id;
+  scope.begin = timestamp();
+  scope.end = 0;
+  open.push_back(frame.scopes.size());
+  frame.scopes.push_back(scope);
+}
+
+void GpuProfiler::end()
+{
+  if (!enabled || open.empty())
+    return;
+  frames[current].scopes[open.back()].end = timestamp();
+  open.pop_back();
+}
+
+std::vector<GpuProfiler::Stats> GpuProfiler::stats() const
+{
+  std::vector<Stats> result;
+  if (nodes.empty())
+    return result;
+
+  // Depth first from the frame scope, children by name
+  std::vector<int> stack(1, 0);
+  while (!stack.empty())
+  {
+    const Node &node = nodes[stack.back()];
+    stack.pop_back();
+    for (std::map<std::string, int>::const_reverse_iterator it = node.children.rbegin();
+         it != node.children.rend(); ++it)
+      stack.push_back(it->second);
+
+    Stats s;
+    s.name = node.name;
+    s.depth = node.depth;
+    s.samples = node.samples.size();
+    s.mean = s.p50 = s.p95 = s.p99 = 0;
+    if (!node.samples.empty())
+    {
+      std::vector<double> sorted(node.samples.begin(), node.samples.end());
+      std::sort(sorted.begin(), sorted.end());
+      for (size_t i = 0; i < sorted.size(); ++i)
+        s.mean += sorted[i];
+      s.mean /= sorted.size();
+      s.p50 = sorted[(sorted.size() - 1) * 50 / 100];
+      s.p95 = sorted[(sorted.size() - 1) * 95 / 100];
+      s.p99 = sorted[(sorted.size() - 1) * 99 / 100];
+    }
+    result.push_back(s);
+  }
+  return result;
+}
+
+void GpuProfiler::print(std::ostream &out) const
+{
+  if (!enabled)
+  {
+    out << "GPU timer queries are not supported" << std::endl;
+    return;
+  }
+  std::vector<Stats> all = stats();
+  char line[160];
+  snprintf(line, sizeof(line), "%-24s %8s %9s %9s %9s %9s", "GPU scope", "frames", "mean ms", "p50 ms", "p95 ms", "p99 ms");
+  out << line << std::endl;
+  for (size_t i = 0; i < all.size(); ++i)
+  {
+    std::string name = std::string(2 * all[i].depth, ' ') + all[i].name;
+    snprintf(line, sizeof(line), "%-24s %8zu %9.3f %9.3f %9.3f %9.3f", name.c_str(), all[i].samples,
+             all[i].mean, all[i].p50, all[i].p95, all[i].p99);
+    out << line << std::endl;
+  }
+  if (dropped > 0)
+    out << dropped << " frames dropped, their results were not ready in time" << std::endl;
+}
+
+bool GpuProfiler::writeCSV(const std::string &path) const
+{
+  std::ofstream out(path.c_str());
+  if (!out)
+  {
+    std::cerr << "Cannot write " << path << std::endl;
+    return false;
+  }
+
+  // Scopes are named by their path from the frame, e.g. frame/draw
+  std::vector<Stats> all = stats();
+  std::vector<std::string> paths(1);
+  out << "scope,frames,mean_ms,p50_ms,p95_ms,p99_ms" << std::endl;
+  for (size_t i = 0; i < all.size(); ++i)
+  {
+    paths.resize(all[i].depth + 1);
+    paths[all[i].depth] = all[i].depth > 0 ? paths[all[i].depth - 1] + "/" + all[i].name : all[i].name;
+    out << paths[all[i].depth] << "," << all[i].samples << "," << all[i].mean << ","
+        << all[i].p50 << "," << all[i].p95 << "," << all[i].p99 << std::endl;
+  }
+  return true;
+}
+
+void GpuProfiler::free()
+{
+  for (size_t i = 0; i < frames.size(); ++i)
+    if (!frames[i].queries.empty())
+      glDeleteQueries((GLsizei) frames[i].queries.size(), frames[i].queries.data());
+  frames.clear();
+  nodes.clear();
+  open.clear();
+  enabled = false;
+}
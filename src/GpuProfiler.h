@@ -0,0 +1,130 @@
+#ifndef GPUPROFILER_H
+#define GPUPROFILER_H
+
+#include "Helpers.h"
+
+#include <deque>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Measures GPU time spent in named, nested scopes with timestamp queries.
+// Each frame records its queries into its own set. A set is read back when
+// it comes around again a few frames later, so the CPU never waits for
+// the GPU; a set whose results are still not available is dropped.
+// Every frame is a scope itself, the others nest inside it.
+class GpuProfiler
+{
+public:
+  typedef unsigned int GLuint;
+
+  // Timing of one scope over the recent frames, in milliseconds
+  class Stats
+  {
+  public:
+    std::string name;
+    int depth;
+    size_t samples;
+    double mean, p50, p95, p99;
+  };
+
+  // False when the driver has no timer queries, then nothing is measured
+  bool enabled;
+
+  // Frames whose results were not ready in time
+  size_t dropped;
+
+  GpuProfiler();
+
+  // Keep latency frames in flight and statistics over the last window
+  // frames. Returns false if timer queries are not supported.
+  bool init(int latency = 4, size_t window = 240);
+
+  // Read back the oldest frame and open the frame scope
+  void beginFrame();
+
+  // Close the frame scope, before swapping buffers
+  void endFrame();
+
+  // Open a scope inside the innermost open one
+  void begin(const char *name);
+
+  // Close the innermost open scope
+  void end();
+
+  // Statistics of every scope seen, parents before their children
+  std::vector<Stats> stats() const;
+
+  // Print the statistics as an indented table
+  void print(std::ostream &out) const;
+
+  // Write the statistics as CSV, false if the file cannot be written
+  bool writeCSV(const std::string &path) const;
+
+  // Release the queries
+  void free();
+
+private:
+  GpuProfiler(const GpuProfiler &);
+  GpuProfiler &operator=(const GpuProfiler &);
+
+  // A scope measured in one frame, between two queries of the frame
+  class Scope
+  {
+  public:
+    int id;
+    size_t begin, end;
+  };
+
+  // Queries and scopes recorded in one frame
+  class Frame
+  {
+  public:
+    std::vector<GLuint> queries;
+    size_t used;
+    std::vector<Scope> scopes;
+    bool pending;
+  };
+
+  // A scope by its path from the frame scope
+  class Node
+  {
+  public:
+    std::string name;
+    int depth;
+    std::map<std::string, int> children;
+    std::deque<double> samples;
+  };
+
+  // Issue a timestamp query in the current frame and return its index
+  size_t timestamp();
+
+  // Add the results of a frame to the samples if they are available
+  void collect(Frame &frame);
+
+  std::vector<Frame> frames;
+  size_t current;
+  size_t window;
+
+  std::vector<Node> nodes;
+
+  // Open scopes, as indices into the current frame's scopes
+  std::vector<size_t> open;
+};
+
+// Times the enclosing block as a scope of a profiler
+class GpuScope
+{
+public:
+  GpuScope(GpuProfiler &profiler, const char *name) : profiler(profiler) { profiler.begin(name); }
+  ~GpuScope() { profiler.end(); }
+
+private:
+  GpuScope(const GpuScope &);
+  GpuScope &operator=(const GpuScope &);
+
+  GpuProfiler &profiler;
+};
+
+#endif
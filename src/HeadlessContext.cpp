@@ -0,0 +1,159 @@
+#include "HeadlessContext.h"
+
+#include <iostream>
+
+#if defined(HEADLESS_EGL)
+#  include <EGL/egl.h>
+#  include <EGL/eglext.h>
+#elif defined(HEADLESS_OSMESA)
+#  include <GL/osmesa.h>
+#endif
+
+HeadlessContext::HeadlessContext() : display(0), context(0)
+{
+}
+
+HeadlessContext::~HeadlessContext()
+{
+  free();
+}
+
+const char *HeadlessContext::backend()
+{
+#if defined(HEADLESS_EGL)
+  return "EGL";
+#elif defined(HEADLESS_OSMESA)
+  return "OSMesa";
+#else
+  return "none";
+#endif
+}
+
+#if defined(HEADLESS_EGL)
+
+bool HeadlessContext::init()
+{
+  // Prefer a surfaceless display, which needs no GPU device or X server
+  EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+    (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (getPlatformDisplay)
+    eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+  if (eglDisplay == EGL_NO_DISPLAY)
+    eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+  EGLint major, minor;
+  if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &major, &minor))
+  {
+    std::cerr << "Cannot initialize an EGL display" << std::endl;
+    return false;
+  }
+  display = eglDisplay;
+
+  if (!eglBindAPI(EGL_OPENGL_API))
+  {
+    std::cerr << "EGL does not support desktop OpenGL" << std::endl;
+    free();
+    return false;
+  }
+
+  const EGLint configAttributes[] = {
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_SURFACE_TYPE, 0,
+    EGL_NONE
+  };
+  EGLConfig config;
+  EGLint configs = 0;
+  if (!eglChooseConfig(eglDisplay, configAttributes, &config, 1, &configs) || configs == 0)
+  {
+    std::cerr << "No EGL config for OpenGL" << std::endl;
+    free();
+    return false;
+  }
+
+  const EGLint contextAttributes[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 3,
+    EGL_CONTEXT_MINOR_VERSION, 2,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+  };
+  EGLContext eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttributes);
+  if (eglContext == EGL_NO_CONTEXT)
+  {
+    std::cerr << "Cannot create an OpenGL 3.2 core context with EGL" << std::endl;
+    free();
+    return false;
+  }
+  context = eglContext;
+
+  // Surfaceless: there is no default framebuffer to draw into
+  if (!eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext))
+  {
+    std::cerr << "Cannot make the EGL context current without a surface" << std::endl;
+    free();
+    return false;
+  }
+  return true;
+}
+
+void HeadlessContext::free()
+{
+  if (display)
+  {
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (context)
+      eglDestroyContext(display, context);
+    eglTerminate(display);
+  }
+  display = 0;
+  context = 0;
+}
+
+#elif defined(HEADLESS_OSMESA)
+
+bool HeadlessContext::init()
+{
+  const int attributes[] = {
+    OSMESA_FORMAT, OSMESA_RGBA,
+    OSMESA_DEPTH_BITS, 0,
+    OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+    OSMESA_CONTEXT_MAJOR_VERSION, 3,
+    OSMESA_CONTEXT_MINOR_VERSION, 2,
+    0
+  };
+  OSMesaContext osmesa = OSMesaCreateContextAttribs(attributes, NULL);
+  if (!osmesa)
+  {
+    std::cerr << "Cannot create an OpenGL 3.2 core context with OSMesa" << std::endl;
+    return false;
+  }
+  context = osmesa;
+  if (!OSMesaMakeCurrent(osmesa, buffer, GL_UNSIGNED_BYTE, 1, 1))
+  {
+    std::cerr << "Cannot make the OSMesa context current" << std::endl;
+    free();
+    return false;
+  }
+  return true;
+}
+
+void HeadlessContext::free()
+{
+  if (context)
+    OSMesaDestroyContext((OSMesaContext) context);
+  context = 0;
+}
+
+#else
+
+bool HeadlessContext::init()
+{
+  std::cerr << "Headless rendering is not available, build with -DHEADLESS=EGL or OSMESA" << std::endl;
+  return false;
+}
+
+void HeadlessContext::free()
+{
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef HEADLESSCONTEXT_H
+#define HEADLESSCONTEXT_H
+
+// An OpenGL 3.2 core context without a window or display server, for
+// rendering into framebuffer objects on batch nodes. The backend is chosen
+// when building (-DHEADLESS=EGL or OSMESA):
+// - EGL uses a surfaceless Mesa display, e.g. llvmpipe on CPU-only nodes
+// - OSMesa renders with Mesa's off screen library
+// Without either, init reports that headless rendering is not available.
+class HeadlessContext
+{
+public:
+  HeadlessContext();
+  ~HeadlessContext();
+
+  // Create the context and make it current, false with a message on error
+  bool init();
+
+  // Release the context
+  void free();
+
+  // Name of the backend compiled in, or "none"
+  static const char *backend();
+
+private:
+  HeadlessContext(const HeadlessContext &);
+  HeadlessContext &operator=(const HeadlessContext &);
+
+  void *display;
+  void *context;
+
+  // OSMesa needs a color buffer to make a context current, even though
+  // everything is drawn into framebuffer objects
+  unsigned char buffer[4];
+};
+
+#endif
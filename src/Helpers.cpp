@@ -1,7 +1,14 @@
 #include "Helpers.h"
+#include "GLState.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
 
 void VertexArrayObject::init()
 {
@@ -11,13 +18,13 @@ void VertexArrayObject::init()
 
 void VertexArrayObject::bind()
 {
-  glBindVertexArray(id);
-  check_gl_error();
+  glState.bindVertexArray(id);
 }
 
 void VertexArrayObject::free()
 {
   glDeleteVertexArrays(1, &id);
+  glState.forgetVertexArray(id);
   check_gl_error();
 }
 
@@ -27,25 +34,422 @@ void VertexBufferObject::init()
   check_gl_error();
 }
 
+void VertexBufferObject::initStreaming(size_t capacity)
+{
+  stream.reset(new StreamingBuffer());
+  stream->init(capacity);
+  id = stream->id;
+  this->capacity = stream->capacity;
+  offset = 0;
+}
+
 void VertexBufferObject::bind()
 {
-  glBindBuffer(GL_ARRAY_BUFFER,id);
-  check_gl_error();
+  glState.bindBuffer(GL_ARRAY_BUFFER,id);
 }
 
 void VertexBufferObject::free()
 {
-  glDeleteBuffers(1,&id);
+  if (stream)
+  {
+    stream->free();
+    stream.reset();
+  }
+  else
+  {
+    glDeleteBuffers(1,&id);
+    glState.forgetBuffer(id);
+  }
+  id = 0;
+  capacity = 0;
+  offset = 0;
+  dirty.clear();
   check_gl_error();
 }
 
 void VertexBufferObject::update(const Eigen::MatrixXf& M)
+{
+  update(M.data(), M.rows(), M.cols());
+}
+
+void VertexBufferObject::update(const float* data, GLuint rows, GLuint cols)
+{
+  upload(data, sizeof(float)*rows*cols);
+  this->rows = rows;
+  this->cols = cols;
+}
+
+void VertexBufferObject::update(const void* data, size_t size)
+{
+  upload(data, size);
+  rows = 0;
+  cols = 0;
+}
+
+void VertexBufferObject::markDirty(GLuint begin, GLuint end)
+{
+  if (begin < end)
+    dirty.push_back(std::make_pair(begin, end));
+}
+
+bool VertexBufferObject::flush(const Eigen::MatrixXf& M)
+{
+  // The ring holds whole copies, the previous one may still be drawn from
+  if (M.rows() != rows || M.cols() != cols || (stream && !dirty.empty()))
+  {
+    update(M);
+    return true;
+  }
+  if (dirty.empty())
+    return false;
+
+  std::sort(dirty.begin(), dirty.end());
+  glState.bindBuffer(GL_ARRAY_BUFFER, id);
+  size_t column = sizeof(float) * rows;
+  size_t i = 0;
+  while (i < dirty.size())
+  {
+    GLuint begin = dirty[i].first, end = std::min(dirty[i].second, cols);
+    for (++i; i < dirty.size() && dirty[i].first <= end; ++i)
+      end = std::max(end, std::min(dirty[i].second, cols));
+    if (begin < end)
+      glBufferSubData(GL_ARRAY_BUFFER, begin * column, (end - begin) * column, M.col(begin).data());
+  }
+  dirty.clear();
+  check_gl_error();
+  return true;
+}
+
+void VertexBufferObject::fence()
+{
+  if (stream)
+    stream->fence();
+}
+
+void VertexBufferObject::upload(const void* data, size_t size)
+{
+  assert(id != 0);
+  dirty.clear();
+  if (stream)
+  {
+    offset = stream->write(data, size);
+    id = stream->id;
+    capacity = stream->capacity;
+    check_gl_error();
+    return;
+  }
+  glState.bindBuffer(GL_ARRAY_BUFFER, id);
+  if (size > capacity)
+  {
+    // The first upload is sized exactly, later ones leave room to grow
+    capacity = capacity == 0 ? size : std::max(size, capacity * 2);
+    glBufferData(GL_ARRAY_BUFFER, capacity, 0, GL_DYNAMIC_DRAW);
+  }
+  if (size > 0)
+    glBufferSubData(GL_ARRAY_BUFFER, 0, size, data);
+  check_gl_error();
+}
+
+bool StreamingBuffer::Region::overlaps(size_t begin, size_t end) const
+{
+  for (int i = 0; i < parts; ++i)
+    if (begin < this->end[i] && this->begin[i] < end)
+      return true;
+  return false;
+}
+
+void StreamingBuffer::init(size_t capacity, GLenum target, Mode mode)
+{
+  this->target = target;
+  if (mode == STREAM_AUTO)
+  {
+#ifdef __APPLE__
+    mode = STREAM_ORPHAN;
+#else
+    mode = GLEW_ARB_buffer_storage ? STREAM_PERSISTENT : STREAM_ORPHAN;
+#endif
+  }
+  this->mode = mode;
+  stalls = 0;
+  allocate(capacity);
+}
+
+void StreamingBuffer::allocate(size_t capacity)
+{
+  this->capacity = capacity;
+  head = regionStart = 0;
+  open.parts = 0;
+  glGenBuffers(1, &id);
+  glState.bindBuffer(target, id);
+#ifndef __APPLE__
+  if (mode == STREAM_PERSISTENT)
+  {
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(target, capacity, 0, flags);
+    mapped = (unsigned char*) glMapBufferRange(target, 0, capacity, flags);
+  }
+  else
+#endif
+    glBufferData(target, capacity, 0, GL_STREAM_DRAW);
+  check_gl_error();
+}
+
+size_t StreamingBuffer::write(const void* data, size_t size, size_t alignment)
+{
+  assert(id != 0);
+  if (size > capacity)
+  {
+    // Too large to ever fit: replace the ring by one twice as large
+    GLenum target = this->target;
+    Mode mode = this->mode;
+    size_t stalls = this->stalls + 1;
+    free();
+    this->target = target;
+    this->mode = mode;
+    this->stalls = stalls;
+    allocate(std::max(size, capacity * 2));
+  }
+
+  size_t offset = (head + alignment - 1) / alignment * alignment;
+  glState.bindBuffer(target, id);
+  if (offset + size > capacity)
+  {
+    // Wrap around, keeping the part written so far in this frame's region
+    if (head > regionStart && open.parts < 2)
+    {
+      open.begin[open.parts] = regionStart;
+      open.end[open.parts] = head;
+      ++open.parts;
+    }
+    offset = 0;
+    regionStart = 0;
+    if (mode == STREAM_ORPHAN)
+      glBufferData(target, capacity, 0, GL_STREAM_DRAW);
+  }
+
+  if (mode == STREAM_PERSISTENT)
+  {
+    // The frame outgrew the ring and would overwrite its own data
+    if (open.parts == 2 || open.overlaps(offset, offset + size))
+    {
+      finish();
+      open.parts = 0;
+    }
+    reserve(offset, offset + size);
+    memcpy(mapped + offset, data, size);
+  }
+  else
+  {
+    void* p = glMapBufferRange(target, offset, size,
+                               GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    memcpy(p, data, size);
+    glUnmapBuffer(target);
+  }
+  head = offset + size;
+  return offset;
+}
+
+void StreamingBuffer::fence()
+{
+  if (mode == STREAM_PERSISTENT)
+  {
+    if (head > regionStart && open.parts < 2)
+    {
+      open.begin[open.parts] = regionStart;
+      open.end[open.parts] = head;
+      ++open.parts;
+    }
+    if (open.parts > 0)
+    {
+      open.sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      regions.push_back(open);
+    }
+  }
+  open.parts = 0;
+  regionStart = head;
+}
+
+void StreamingBuffer::reserve(size_t begin, size_t end)
+{
+  // Fences signal in order, so waiting for one retires all older regions
+  size_t last = 0;
+  for (size_t i = 0; i < regions.size(); ++i)
+    if (regions[i].overlaps(begin, end))
+      last = i + 1;
+  if (last == 0)
+    return;
+
+  GLsync sync = regions[last - 1].sync;
+  if (glClientWaitSync(sync, 0, 0) == GL_TIMEOUT_EXPIRED)
+  {
+    ++stalls;
+    while (glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+      ;
+  }
+  for (size_t i = 0; i < last; ++i)
+    glDeleteSync(regions[i].sync);
+  regions.erase(regions.begin(), regions.begin() + last);
+}
+
+void StreamingBuffer::finish()
+{
+  if (!regions.empty() || open.parts > 0)
+  {
+    ++stalls;
+    glFinish();
+  }
+  for (size_t i = 0; i < regions.size(); ++i)
+    glDeleteSync(regions[i].sync);
+  regions.clear();
+}
+
+void StreamingBuffer::free()
+{
+  if (id != 0)
+  {
+    finish();
+    glState.bindBuffer(target, id);
+    if (mapped)
+      glUnmapBuffer(target);
+    glDeleteBuffers(1, &id);
+    glState.forgetBuffer(id);
+  }
+  id = 0;
+  capacity = 0;
+  mapped = 0;
+  head = regionStart = 0;
+  open.parts = 0;
+  check_gl_error();
+}
+
+void IndexBufferObject::init()
+{
+  glGenBuffers(1,&id);
+  check_gl_error();
+}
+
+void IndexBufferObject::bind()
+{
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,id);
+  check_gl_error();
+}
+
+void IndexBufferObject::free()
+{
+  glDeleteBuffers(1,&id);
+  glState.forgetBuffer(id);
+  check_gl_error();
+}
+
+void IndexBufferObject::update(const GLuint* indices, GLsizei count, GLuint vertices)
 {
   assert(id != 0);
-  glBindBuffer(GL_ARRAY_BUFFER, id);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(float)*M.size(), M.data(), GL_DYNAMIC_DRAW);
-  rows = M.rows();
-  cols = M.cols();
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, id);
+  if (indexSize(vertices) == sizeof(unsigned short))
+  {
+    std::vector<unsigned short> shorts(indices, indices + count);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short)*count, shorts.data(), GL_STATIC_DRAW);
+    type = GL_UNSIGNED_SHORT;
+  }
+  else
+  {
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint)*count, indices, GL_STATIC_DRAW);
+    type = GL_UNSIGNED_INT;
+  }
+  this->count = count;
+  check_gl_error();
+}
+
+void IndexBufferObject::draw()
+{
+  glDrawElements(GL_TRIANGLES, count, type, 0);
+}
+
+void IndexBufferObject::draw(GLsizei first, GLsizei count)
+{
+  size_t size = type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(GLuint);
+  glDrawElements(GL_TRIANGLES, count, type, (void*)(first * size));
+}
+
+void IndexBufferObject::drawInstanced(GLsizei first, GLsizei count, GLsizei instances)
+{
+  size_t size = type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(GLuint);
+  glDrawElementsInstanced(GL_TRIANGLES, count, type, (void*)(first * size), instances);
+}
+
+size_t IndexBufferObject::bytes() const
+{
+  return count * (type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(GLuint));
+}
+
+size_t IndexBufferObject::indexSize(GLuint vertices)
+{
+  return vertices <= 65536 ? sizeof(unsigned short) : sizeof(GLuint);
+}
+
+bool FrameBufferObject::init(int width, int height)
+{
+  this->width = width;
+  this->height = height;
+  glGenRenderbuffers(1, &color);
+  glBindRenderbuffer(GL_RENDERBUFFER, color);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glGenRenderbuffers(1, &depth);
+  glBindRenderbuffer(GL_RENDERBUFFER, depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+  glGenFramebuffers(1, &id);
+  glBindFramebuffer(GL_FRAMEBUFFER, id);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+  GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  check_gl_error();
+  if (status != GL_FRAMEBUFFER_COMPLETE)
+  {
+    std::cerr << "Incomplete framebuffer of " << width << "x" << height << ": 0x" << std::hex << status
+              << std::dec << std::endl;
+    free();
+    return false;
+  }
+  return true;
+}
+
+void FrameBufferObject::bind()
+{
+  glBindFramebuffer(GL_FRAMEBUFFER, id);
+  glViewport(0, 0, width, height);
+}
+
+void FrameBufferObject::read(std::vector<unsigned char>& rgb)
+{
+  size_t row = size_t(width) * 3;
+  rgb.resize(row * height);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, id);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, rgb.data());
+  check_gl_error();
+
+  // GL rows start at the bottom
+  std::vector<unsigned char> swap(row);
+  for (int y = 0; y < height / 2; ++y)
+  {
+    unsigned char* top = &rgb[y * row];
+    unsigned char* bottom = &rgb[(height - 1 - y) * row];
+    std::copy(top, top + row, swap.begin());
+    std::copy(bottom, bottom + row, top);
+    std::copy(swap.begin(), swap.end(), bottom);
+  }
+}
+
+void FrameBufferObject::free()
+{
+  if (id)
+    glDeleteFramebuffers(1, &id);
+  if (color)
+    glDeleteRenderbuffers(1, &color);
+  if (depth)
+    glDeleteRenderbuffers(1, &depth);
+  id = color = depth = 0;
   check_gl_error();
 }
 
@@ -81,24 +485,88 @@ bool Program::init(
     return false;
   }
 
+  reflect();
   check_gl_error();
   return true;
 }
 
+void Program::reflect()
+{
+  attributes.clear();
+  uniforms.clear();
+  blocks.clear();
+  char name[256];
+  GLint count;
+
+  glGetProgramiv(program_shader, GL_ACTIVE_ATTRIBUTES, &count);
+  for (GLint i = 0; i < count; ++i)
+  {
+    GLint size;
+    GLenum type;
+    glGetActiveAttrib(program_shader, i, sizeof(name), NULL, &size, &type, name);
+    GLint location = glGetAttribLocation(program_shader, name);
+    if (location >= 0)
+      attributes[name] = location;
+  }
+
+  glGetProgramiv(program_shader, GL_ACTIVE_UNIFORMS, &count);
+  for (GLint i = 0; i < count; ++i)
+  {
+    GLint size;
+    GLenum type;
+    glGetActiveUniform(program_shader, i, sizeof(name), NULL, &size, &type, name);
+
+    // Uniforms inside blocks have no location
+    GLint location = glGetUniformLocation(program_shader, name);
+    if (location < 0)
+      continue;
+    uniforms[name] = location;
+
+    // Arrays are reported as "name[0]", also accept the bare name
+    std::string array(name);
+    if (array.size() > 3 && array.compare(array.size() - 3, 3, "[0]") == 0)
+      uniforms[array.substr(0, array.size() - 3)] = location;
+  }
+
+  glGetProgramiv(program_shader, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+  for (GLint i = 0; i < count; ++i)
+  {
+    glGetActiveUniformBlockName(program_shader, i, sizeof(name), NULL, name);
+    blocks[name] = i;
+  }
+}
+
 void Program::bind()
 {
-  glUseProgram(program_shader);
-  check_gl_error();
+  glState.useProgram(program_shader);
 }
 
 GLint Program::attrib(const std::string &name) const
 {
-  return glGetAttribLocation(program_shader, name.c_str());
+  std::unordered_map<std::string, GLint>::const_iterator it = attributes.find(name);
+  return it == attributes.end() ? -1 : it->second;
 }
 
 GLint Program::uniform(const std::string &name) const
 {
-  return glGetUniformLocation(program_shader, name.c_str());
+  std::unordered_map<std::string, GLint>::const_iterator it = uniforms.find(name);
+  return it == uniforms.end() ? -1 : it->second;
+}
+
+GLint Program::uniformBlock(const std::string &name) const
+{
+  std::unordered_map<std::string, GLint>::const_iterator it = blocks.find(name);
+  return it == blocks.end() ? -1 : it->second;
+}
+
+bool Program::bindUniformBlock(const std::string &name, GLuint binding)
+{
+  GLint index = uniformBlock(name);
+  if (index < 0)
+    return false;
+  glUniformBlockBinding(program_shader, index, binding);
+  check_gl_error();
+  return true;
 }
 
 GLint Program::bindVertexAttribArray(
@@ -114,7 +582,7 @@ GLint Program::bindVertexAttribArray(
   }
   VBO.bind();
   glEnableVertexAttribArray(id);
-  glVertexAttribPointer(id, VBO.rows, GL_FLOAT, GL_FALSE, 0, 0);
+  glVertexAttribPointer(id, VBO.rows, GL_FLOAT, GL_FALSE, 0, (const GLvoid*) VBO.offset);
   check_gl_error();
 
   return id;
@@ -125,6 +593,7 @@ void Program::free()
   if (program_shader)
   {
     glDeleteProgram(program_shader);
+    glState.forgetProgram(program_shader);
     program_shader = 0;
   }
   if (vertex_shader)
@@ -137,6 +606,9 @@ void Program::free()
     glDeleteShader(fragment_shader);
     fragment_shader = 0;
   }
+  attributes.clear();
+  uniforms.clear();
+  blocks.clear();
   check_gl_error();
 }
 
@@ -173,8 +645,192 @@ GLuint Program::create_shader_helper(GLint type, const std::string &shader_strin
   return id;
 }
 
+void UniformBuffer::init(size_t size, GLuint binding, size_t blocksPerFrame)
+{
+  this->size = size;
+  this->binding = binding;
+  GLint align = 0;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+  alignment = std::max<size_t>(align, 16);
+  stream.reset(new StreamingBuffer());
+  stream->init(3 * std::max<size_t>(blocksPerFrame, 1) * alignedSize(), GL_UNIFORM_BUFFER);
+  block.assign(size, 0);
+  update(block.data(), size);
+}
+
+void UniformBuffer::update(const void* data, size_t size, size_t offset)
+{
+  assert(stream && offset + size <= this->size);
+  memcpy(&block[offset], data, size);
+  this->offset = stream->write(block.data(), this->size, alignment);
+  id = stream->id;
+  bind();
+  check_gl_error();
+}
+
+size_t UniformBuffer::write(const void* data, size_t count, size_t stride)
+{
+  assert(stream && count > 0);
+  size_t aligned = alignedSize();
+  staging.resize(aligned * count);
+  for (size_t i = 0; i < count; ++i)
+    memcpy(&staging[i * aligned], (const unsigned char*) data + i * stride, size);
+  memcpy(block.data(), &staging[(count - 1) * aligned], size);
+  size_t first = stream->write(staging.data(), staging.size(), alignment);
+  id = stream->id;
+  check_gl_error();
+  return first;
+}
+
+void UniformBuffer::bind()
+{
+  glState.bindBufferRange(GL_UNIFORM_BUFFER, binding, id, offset, size);
+}
+
+void UniformBuffer::bind(size_t offset)
+{
+  this->offset = offset;
+  bind();
+}
+
+void UniformBuffer::fence()
+{
+  stream->fence();
+}
+
+void UniformBuffer::free()
+{
+  if (stream)
+    stream->free();
+  stream.reset();
+  id = 0;
+  offset = 0;
+  size = 0;
+  check_gl_error();
+}
+
+#ifdef NDEBUG
+GLDiagnostics glDiagnostics = DIAGNOSTICS_OFF;
+#else
+GLDiagnostics glDiagnostics = DIAGNOSTICS_SYNC;
+#endif
+
+namespace
+{
+  const char* diagnosticsNames[] = { "off", "callback", "sync" };
+
+  // Last call site passed to check_gl_error, read by the debug callback
+  // which may run on a driver thread
+  std::atomic<const char*> lastFile(0);
+  std::atomic<int> lastLine(0);
+
+  // Occurrences of each distinct message at each call site
+  std::mutex diagnosticsMutex;
+  std::map<std::string, size_t> diagnostics;
+
+  void reportGLMessage(const std::string &message, const char *file, int line, bool after)
+  {
+    std::ostringstream site;
+    if (file)
+      site << (after ? "after " : "") << file << ":" << line;
+    else
+      site << "before the first check";
+    std::string key = message + " - " + site.str();
+
+    std::lock_guard<std::mutex> lock(diagnosticsMutex);
+    if (diagnostics[key]++ == 0)
+      std::cerr << key << std::endl;
+  }
+
+#ifndef __APPLE__
+  const char* debugTypeName(GLenum type)
+  {
+    switch (type)
+    {
+      case GL_DEBUG_TYPE_ERROR:               return "ERROR";
+      case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "DEPRECATED";
+      case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:  return "UNDEFINED";
+      case GL_DEBUG_TYPE_PORTABILITY:         return "PORTABILITY";
+      case GL_DEBUG_TYPE_PERFORMANCE:         return "PERFORMANCE";
+      default:                                return "MESSAGE";
+    }
+  }
+
+  void GLAPIENTRY debugCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
+                                GLsizei length, const GLchar *message, const void *user)
+  {
+    (void) source; (void) id; (void) severity; (void) user;
+    reportGLMessage(std::string("GL_") + debugTypeName(type) + " " + std::string(message, length),
+                    lastFile.load(), lastLine.load(), true);
+  }
+#endif
+}
+
+const char* glDiagnosticsName(GLDiagnostics level)
+{
+  return diagnosticsNames[level];
+}
+
+bool parseGLDiagnostics(const std::string &name, GLDiagnostics &level)
+{
+  for (int i = DIAGNOSTICS_OFF; i <= DIAGNOSTICS_SYNC; ++i)
+    if (name == diagnosticsNames[i])
+    {
+      level = (GLDiagnostics) i;
+      return true;
+    }
+  return false;
+}
+
+bool setGLDiagnostics(GLDiagnostics level)
+{
+  // Errors raised before the switch belong to no call site we know
+  while (glGetError() != GL_NO_ERROR)
+    ;
+
+#ifndef __APPLE__
+  if (GLEW_KHR_debug)
+  {
+    if (level == DIAGNOSTICS_CALLBACK)
+    {
+      glDebugMessageCallback(debugCallback, 0);
+      glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, 0, GL_TRUE);
+      glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, 0, GL_FALSE);
+      glEnable(GL_DEBUG_OUTPUT);
+    }
+    else
+      glDisable(GL_DEBUG_OUTPUT);
+    glDiagnostics = level;
+    return true;
+  }
+#endif
+
+  if (level == DIAGNOSTICS_CALLBACK)
+  {
+    std::cerr << "KHR_debug is not supported, checking GL errors synchronously" << std::endl;
+    glDiagnostics = DIAGNOSTICS_SYNC;
+    return false;
+  }
+  glDiagnostics = level;
+  return true;
+}
+
+void reportGLDiagnostics()
+{
+  std::lock_guard<std::mutex> lock(diagnosticsMutex);
+  for (std::map<std::string, size_t>::const_iterator it = diagnostics.begin(); it != diagnostics.end(); ++it)
+    std::cerr << it->second << "x " << it->first << std::endl;
+}
+
 void _check_gl_error(const char *file, int line)
 {
+  if (glDiagnostics == DIAGNOSTICS_CALLBACK)
+  {
+    lastFile.store(file);
+    lastLine.store(line);
+    return;
+  }
+
   GLenum err (glGetError());
 
   while(err!=GL_NO_ERROR)
@@ -190,9 +846,7 @@ void _check_gl_error(const char *file, int line)
       case GL_INVALID_FRAMEBUFFER_OPERATION:  error="INVALID_FRAMEBUFFER_OPERATION";  break;
     }
 
-    std::cerr << "GL_" << error.c_str() << " - " << file << ":" << line << std::endl;
+    reportGLMessage("GL_" + error, file, line, false);
     err = glGetError();
   }
 }
-
-
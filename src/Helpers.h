@@ -2,6 +2,9 @@
 #define SHADER_H
 
 #include <string>
+#include <deque>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 #include <Eigen/Core>
 
@@ -44,6 +47,8 @@ public:
     void free();
 };
 
+class StreamingBuffer;
+
 class VertexBufferObject
 {
 public:
@@ -54,21 +59,214 @@ public:
     GLuint rows;
     GLuint cols;
 
-    VertexBufferObject() : id(0), rows(0), cols(0) {}
+    // Bytes of storage allocated on the GPU
+    size_t capacity;
+
+    // Where the data starts in the buffer, 0 unless streaming
+    size_t offset;
+
+    VertexBufferObject() : id(0), rows(0), cols(0), capacity(0), offset(0) {}
 
     // Create a new empty VBO
     void init();
 
+    // Create a VBO for data rewritten every frame. Updates go through a
+    // StreamingBuffer ring of capacity bytes, so they never wait for draws
+    // still reading the previous data. Each update moves the data to a new
+    // offset and may change the id, so attribute pointers must be set
+    // again after it. Meant for data rewritten whole: a VBO edited a few
+    // columns at a time should use init and flush instead.
+    void initStreaming(size_t capacity);
+
     // Updates the VBO with a matrix M
     void update(const Eigen::MatrixXf& M);
 
+    // Updates the VBO with cols vertices of rows floats each, e.g. straight
+    // from a memory mapped mesh cache
+    void update(const float* data, GLuint rows, GLuint cols);
+
+    // Updates the VBO with size bytes of packed vertices
+    void update(const void* data, size_t size);
+
+    // Record that columns [begin, end) of the source matrix changed
+    void markDirty(GLuint begin, GLuint end);
+
+    // Upload the columns of M marked dirty since the last flush, merging
+    // overlapping and adjacent ranges into one glBufferSubData each. Does
+    // nothing when no column is dirty, and uploads all of M when its size
+    // differs from the last update. A streaming VBO uploads all of M when
+    // any column is dirty. Call once per frame before drawing. Returns true
+    // if anything was uploaded.
+    bool flush(const Eigen::MatrixXf& M);
+
+    // Close the frame's writes of a streaming VBO, after the draws reading
+    // them. Does nothing for other VBOs.
+    void fence();
+
     // Select this VBO for subsequent draw calls
     void bind();
 
+    // Release the id
+    void free();
+
+private:
+    // Write size bytes at the start of the buffer, or of a new region of
+    // the ring when streaming. The storage is only reallocated when it is
+    // too small, and then grows geometrically.
+    void upload(const void* data, size_t size);
+
+    // Column ranges changed since the last upload
+    std::vector<std::pair<GLuint, GLuint> > dirty;
+
+    // The ring of a streaming VBO, shared by copies
+    std::shared_ptr<StreamingBuffer> stream;
+};
+
+// A ring buffer for data rewritten every frame, e.g. dynamic vertices or
+// per frame constants. Each write lands in a region the GPU is not reading,
+// so the CPU never waits for draws still in flight:
+// - STREAM_PERSISTENT maps the buffer once (ARB_buffer_storage) and fences
+//   every frame's region, waiting only if the ring wraps onto a region the
+//   GPU has not finished
+// - STREAM_ORPHAN maps each region unsynchronized and orphans the storage
+//   when the ring wraps, leaving the old storage to the draws using it
+class StreamingBuffer
+{
+public:
+    typedef unsigned int GLuint;
+    typedef unsigned int GLenum;
+
+    enum Mode { STREAM_AUTO, STREAM_ORPHAN, STREAM_PERSISTENT };
+
+    GLuint id;
+    GLenum target;
+    size_t capacity;
+    Mode mode;
+
+    // Number of writes that had to wait for the GPU
+    size_t stalls;
+
+    StreamingBuffer() : id(0), target(GL_ARRAY_BUFFER), capacity(0), mode(STREAM_AUTO), stalls(0),
+                        head(0), regionStart(0), mapped(0) { open.parts = 0; }
+
+    // Create a ring of capacity bytes bound to target. STREAM_AUTO picks
+    // persistent mapping when the driver supports it. The capacity should
+    // hold about three frames of writes.
+    void init(size_t capacity, GLenum target = GL_ARRAY_BUFFER, Mode mode = STREAM_AUTO);
+
+    // Copy size bytes into the ring and return their offset in the buffer,
+    // a multiple of alignment. The buffer is left bound to target. A write
+    // larger than the ring replaces it by a larger buffer with a new id.
+    size_t write(const void* data, size_t size, size_t alignment = 16);
+
+    // Close the region written since the last call. Call once per frame,
+    // after the draws that read it have been issued.
+    void fence();
+
+    // Wait for the GPU and release the buffer
+    void free();
+
+private:
+    StreamingBuffer(const StreamingBuffer&);
+    StreamingBuffer& operator=(const StreamingBuffer&);
+
+    // Bytes of the ring written in one frame, in two parts if it wrapped
+    class Region
+    {
+    public:
+        GLsync sync;
+        size_t begin[2], end[2];
+        int parts;
+
+        bool overlaps(size_t begin, size_t end) const;
+    };
+
+    // Create the storage and map it if persistent
+    void allocate(size_t capacity);
+
+    // Wait for the GPU to finish the fenced regions overlapping [begin, end)
+    void reserve(size_t begin, size_t end);
+
+    // Wait for the GPU to finish everything and drop all regions
+    void finish();
+
+    size_t head;
+    size_t regionStart;
+    Region open;
+    std::deque<Region> regions;
+    unsigned char* mapped;
+};
+
+class IndexBufferObject
+{
+public:
+    typedef unsigned int GLuint;
+    typedef int GLsizei;
+    typedef unsigned int GLenum;
+
+    GLuint id;
+    GLsizei count;
+    GLenum type;
+
+    IndexBufferObject() : id(0), count(0), type(GL_UNSIGNED_INT) {}
+
+    // Create a new empty element buffer
+    void init();
+
+    // Updates the buffer with count indices into a vertex buffer of
+    // vertices entries. 16 bit indices are stored whenever they fit.
+    void update(const GLuint* indices, GLsizei count, GLuint vertices);
+
+    // Select this buffer as the element buffer of the bound VAO
+    void bind();
+
+    // Draw count indices as triangles
+    void draw();
+
+    // Draw the count indices starting at index first as triangles
+    void draw(GLsizei first, GLsizei count);
+
+    // Draw the count indices starting at index first instances times
+    void drawInstanced(GLsizei first, GLsizei count, GLsizei instances);
+
+    // Size of the stored indices in bytes
+    size_t bytes() const;
+
+    // Bytes per index stored for a vertex buffer of vertices entries
+    static size_t indexSize(GLuint vertices);
+
     // Release the id
     void free();
 };
 
+// An offscreen render target with an RGBA8 color and a 24 bit depth
+// renderbuffer, for rendering without a window
+class FrameBufferObject
+{
+public:
+    typedef unsigned int GLuint;
+
+    GLuint id;
+    GLuint color;
+    GLuint depth;
+    int width;
+    int height;
+
+    FrameBufferObject() : id(0), color(0), depth(0), width(0), height(0) {}
+
+    // Create the framebuffer, false if the driver cannot render to it
+    bool init(int width, int height);
+
+    // Draw into this framebuffer and set the viewport to cover it
+    void bind();
+
+    // Read the color buffer as RGB rows from top to bottom
+    void read(std::vector<unsigned char>& rgb);
+
+    // Release the framebuffer and its renderbuffers
+    void free();
+};
+
 // This class wraps an OpenGL program composed of two shaders
 class Program
 {
@@ -99,13 +297,131 @@ public:
   // Return the OpenGL handle of a uniform attribute (-1 if it does not exist)
   GLint uniform(const std::string &name) const;
 
+  // Return the index of a named uniform block (-1 if it does not exist)
+  GLint uniformBlock(const std::string &name) const;
+
+  // Read the block from the uniform buffer bound to binding, false if the
+  // block does not exist
+  bool bindUniformBlock(const std::string &name, GLuint binding);
+
   // Bind a per-vertex array attribute
   GLint bindVertexAttribArray(const std::string &name, VertexBufferObject& VBO) const;
 
   GLuint create_shader_helper(GLint type, const std::string &shader_string);
 
+private:
+  // Look up all active attributes, uniforms and uniform blocks once after
+  // linking, so that attrib and uniform never query the driver
+  void reflect();
+
+  std::unordered_map<std::string, GLint> attributes;
+  std::unordered_map<std::string, GLint> uniforms;
+  std::unordered_map<std::string, GLint> blocks;
 };
 
+// A buffer backing a uniform block, e.g. matrices shared by the draws of a
+// frame. The data must follow the std140 layout of the block: an
+// Eigen::Matrix4f maps to a mat4, and vec3 members take 16 bytes.
+//
+// Every update writes a new copy of the block into a StreamingBuffer ring,
+// at an offset aligned to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, and binds that
+// range. Draws still in flight keep reading their own copy, so updates
+// between draws never wait for the GPU.
+class UniformBuffer
+{
+public:
+  typedef unsigned int GLuint;
+
+  GLuint id;
+  GLuint binding;
+  size_t size;
+
+  // Offset of the current copy of the block in the buffer
+  size_t offset;
+
+  UniformBuffer() : id(0), binding(0), size(0), offset(0), alignment(0) {}
+
+  // Create a buffer for a block of size bytes bound to binding, with room
+  // for about three frames of blocksPerFrame updates each
+  void init(size_t size, GLuint binding, size_t blocksPerFrame = 16);
+
+  // Change size bytes at offset of the block and bind the new copy
+  void update(const void* data, size_t size, size_t offset = 0);
+
+  // Write a whole block
+  template <typename Block>
+  void update(const Block &block) { update(&block, sizeof(Block)); }
+
+  // Write count blocks, stride bytes apart in data, as consecutive copies
+  // in a single write to the ring, without binding them. Returns the offset
+  // of the first; copy i is at offset + i * alignedSize().
+  size_t write(const void* data, size_t count, size_t stride);
+
+  // Bytes between consecutive copies: the block size rounded up to the
+  // offset alignment
+  size_t alignedSize() const { return (size + alignment - 1) / alignment * alignment; }
+
+  // Bind the current copy to its binding point again
+  void bind();
+
+  // Make the copy at offset, returned by write, the current one and bind it
+  void bind(size_t offset);
+
+  // Close the frame's updates, after the draws reading them. Call once per
+  // frame.
+  void fence();
+
+  // Release the id
+  void free();
+
+private:
+  UniformBuffer(const UniformBuffer&);
+  UniformBuffer& operator=(const UniformBuffer&);
+
+  size_t alignment;
+
+  // The block as last written, for partial updates
+  std::vector<unsigned char> block;
+
+  // Copies laid out for write
+  std::vector<unsigned char> staging;
+
+  std::shared_ptr<StreamingBuffer> stream;
+};
+
+// How GL errors are reported
+enum GLDiagnostics
+{
+  // check_gl_error does nothing, the default in release builds
+  DIAGNOSTICS_OFF,
+
+  // The driver reports errors and warnings through a KHR_debug callback
+  // without stalling. check_gl_error only records its call site, and
+  // messages are attributed to the last site recorded before them.
+  DIAGNOSTICS_CALLBACK,
+
+  // check_gl_error calls glGetError, which waits for the driver but pins
+  // every error to the call before it. The default in debug builds.
+  DIAGNOSTICS_SYNC
+};
+
+// The current level, read by check_gl_error
+extern GLDiagnostics glDiagnostics;
+
+// Name of a level as used on the command line: off, callback or sync
+const char* glDiagnosticsName(GLDiagnostics level);
+
+// Parse a level name, false if it is unknown
+bool parseGLDiagnostics(const std::string &name, GLDiagnostics &level);
+
+// Switch to a level with the context current. Falls back to synchronous
+// checks and returns false if the driver has no KHR_debug.
+bool setGLDiagnostics(GLDiagnostics level);
+
+// Print every distinct message with its call site and how often it was
+// reported. Each message is also printed the first time it occurs.
+void reportGLDiagnostics();
+
 // From: https://blog.nobel-joergensen.com/2013/01/29/debugging-opengl-using-glgeterror/
 void _check_gl_error(const char *file, int line);
 
@@ -114,6 +430,6 @@ void _check_gl_error(const char *file, int line);
 /// [... some opengl calls]
 /// glCheckError();
 ///
-#define check_gl_error() _check_gl_error(__FILE__,__LINE__)
+#define check_gl_error() do { if (glDiagnostics != DIAGNOSTICS_OFF) _check_gl_error(__FILE__,__LINE__); } while (0)
 
 #endif
@@ -0,0 +1,309 @@
+#include "ImageWriter.h"
+#include "Trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+namespace
+{
+  void put32(std::vector<unsigned char> &out, uint32_t v)
+  {
+    // Big endian, as both PNG and QOI store their integers
+    out.push_back((unsigned char) (v >> 24));
+    out.push_back((unsigned char) (v >> 16));
+    out.push_back((unsigned char) (v >> 8));
+    out.push_back((unsigned char) v);
+  }
+
+  class CrcTable
+  {
+  public:
+    uint32_t entries[256];
+
+    CrcTable()
+    {
+      for (uint32_t i = 0; i < 256; ++i)
+      {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k)
+          c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        entries[i] = c;
+      }
+    }
+  };
+
+  uint32_t crc32(const unsigned char *data, size_t size)
+  {
+    // Built once on first use, safely from any thread
+    static const CrcTable table;
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < size; ++i)
+      crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+  }
+
+  uint32_t adler32(const unsigned char *data, size_t size)
+  {
+    uint32_t a = 1, b = 0;
+    while (size > 0)
+    {
+      // The sums cannot overflow within 5552 bytes
+      size_t n = size < 5552 ? size : 5552;
+      for (size_t i = 0; i < n; ++i)
+      {
+        a += data[i];
+        b += a;
+      }
+      a %= 65521;
+      b %= 65521;
+      data += n;
+      size -= n;
+    }
+    return (b << 16) | a;
+  }
+
+  void pngChunk(std::vector<unsigned char> &out, const char *type, const std::vector<unsigned char> &data)
+  {
+    put32(out, (uint32_t) data.size());
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    put32(out, crc32(&out[start], out.size() - start));
+  }
+
+  void encodePPM(const std::vector<unsigned char> &rgb, int width, int height, std::vector<unsigned char> &file)
+  {
+    char header[64];
+    int length = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    file.assign(header, header + length);
+    file.insert(file.end(), rgb.begin(), rgb.end());
+  }
+
+  void encodePNG(const std::vector<unsigned char> &rgb, int width, int height, std::vector<unsigned char> &file)
+  {
+    static const unsigned char signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+    file.assign(signature, signature + 8);
+
+    std::vector<unsigned char> header;
+    put32(header, width);
+    put32(header, height);
+    const unsigned char format[5] = { 8, 2, 0, 0, 0 }; // 8 bit RGB, no interlacing
+    header.insert(header.end(), format, format + 5);
+    pngChunk(file, "IHDR", header);
+
+    // Every row starts with filter type 0, the bytes as they are
+    size_t stride = size_t(width) * 3;
+    std::vector<unsigned char> raw((stride + 1) * height);
+    for (int y = 0; y < height; ++y)
+    {
+      raw[y * (stride + 1)] = 0;
+      memcpy(&raw[y * (stride + 1) + 1], &rgb[y * stride], stride);
+    }
+
+    // A zlib stream of stored deflate blocks of at most 65535 bytes
+    std::vector<unsigned char> data;
+    data.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    data.push_back(0x78);
+    data.push_back(0x01);
+    size_t offset = 0;
+    do
+    {
+      size_t n = raw.size() - offset < 65535 ? raw.size() - offset : 65535;
+      data.push_back(offset + n == raw.size() ? 1 : 0);
+      data.push_back((unsigned char) n);
+      data.push_back((unsigned char) (n >> 8));
+      data.push_back((unsigned char) ~n);
+      data.push_back((unsigned char) (~n >> 8));
+      data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + n);
+      offset += n;
+    } while (offset < raw.size());
+    put32(data, adler32(raw.data(), raw.size()));
+    pngChunk(file, "IDAT", data);
+    pngChunk(file, "IEND", std::vector<unsigned char>());
+  }
+
+  void encodeQOI(const std::vector<unsigned char> &rgb, int width, int height, std::vector<unsigned char> &file)
+  {
+    file.clear();
+    file.reserve(14 + rgb.size() / 2 + 8);
+    const char magic[4] = { 'q', 'o', 'i', 'f' };
+    file.insert(file.end(), magic, magic + 4);
+    put32(file, width);
+    put32(file, height);
+    file.push_back(3); // RGB
+    file.push_back(0); // sRGB with linear alpha
+
+    // Opaque pixels only. The index starts out transparent, so its alpha is
+    // kept to tell the slots never written apart from black.
+    unsigned char index[64][4];
+    memset(index, 0, sizeof(index));
+    unsigned char previous[3] = { 0, 0, 0 };
+    int run = 0;
+    size_t pixels = size_t(width) * height;
+    for (size_t i = 0; i < pixels; ++i)
+    {
+      const unsigned char *p = &rgb[i * 3];
+      if (p[0] == previous[0] && p[1] == previous[1] && p[2] == previous[2])
+      {
+        if (++run == 62 || i + 1 == pixels)
+        {
+          file.push_back((unsigned char) (0xc0 | (run - 1)));
+          run = 0;
+        }
+        continue;
+      }
+      if (run > 0)
+      {
+        file.push_back((unsigned char) (0xc0 | (run - 1)));
+        run = 0;
+      }
+
+      int slot = (p[0] * 3 + p[1] * 5 + p[2] * 7 + 255 * 11) % 64;
+      if (index[slot][0] == p[0] && index[slot][1] == p[1] && index[slot][2] == p[2] && index[slot][3] == 255)
+        file.push_back((unsigned char) slot);
+      else
+      {
+        memcpy(index[slot], p, 3);
+        index[slot][3] = 255;
+        signed char dr = (signed char) (p[0] - previous[0]);
+        signed char dg = (signed char) (p[1] - previous[1]);
+        signed char db = (signed char) (p[2] - previous[2]);
+        signed char drg = (signed char) (dr - dg);
+        signed char dbg = (signed char) (db - dg);
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+          file.push_back((unsigned char) (0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+        else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+        {
+          file.push_back((unsigned char) (0x80 | (dg + 32)));
+          file.push_back((unsigned char) ((drg + 8) << 4 | (dbg + 8)));
+        }
+        else
+        {
+          file.push_back(0xfe);
+          file.insert(file.end(), p, p + 3);
+        }
+      }
+      memcpy(previous, p, 3);
+    }
+    const unsigned char end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    file.insert(file.end(), end, end + 8);
+  }
+}
+
+const char *imageFormatName(ImageFormat format)
+{
+  switch (format)
+  {
+  case IMAGE_PPM:
+    return "ppm";
+  case IMAGE_PNG:
+    return "png";
+  case IMAGE_QOI:
+    return "qoi";
+  }
+  return "unknown";
+}
+
+bool parseImageFormat(const std::string &name, ImageFormat &format)
+{
+  const ImageFormat formats[] = { IMAGE_PPM, IMAGE_PNG, IMAGE_QOI };
+  for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i)
+    if (name == imageFormatName(formats[i]))
+    {
+      format = formats[i];
+      return true;
+    }
+  return false;
+}
+
+void encodeImage(const std::vector<unsigned char> &rgb, int width, int height, ImageFormat format,
+                 std::vector<unsigned char> &file)
+{
+  switch (format)
+  {
+  case IMAGE_PPM:
+    encodePPM(rgb, width, height, file);
+    break;
+  case IMAGE_PNG:
+    encodePNG(rgb, width, height, file);
+    break;
+  case IMAGE_QOI:
+    encodeQOI(rgb, width, height, file);
+    break;
+  }
+}
+
+bool writeImage(const std::string &path, const std::vector<unsigned char> &rgb, int width, int height,
+                ImageFormat format)
+{
+  std::vector<unsigned char> file;
+  {
+    TRACE_SCOPE("encode");
+    encodeImage(rgb, width, height, format, file);
+  }
+
+  TRACE_SCOPE("write file");
+  FILE *out = fopen(path.c_str(), "wb");
+  if (!out)
+  {
+    std::cerr << "Cannot write " << path << std::endl;
+    return false;
+  }
+  bool written = fwrite(file.data(), 1, file.size(), out) == file.size();
+  written = fclose(out) == 0 && written;
+  if (!written)
+    std::cerr << "Cannot write " << path << std::endl;
+  return written;
+}
+
+ImageWriter::ImageWriter(ThreadPool *pool, size_t maxQueued)
+  : pool(pool), maxQueued(maxQueued > 0 ? maxQueued : 2 * pool->size()), queued(0), succeeded(0), errors(0),
+    encodeTime(0), blockedTime(0)
+{
+}
+
+ImageWriter::~ImageWriter()
+{
+  wait();
+}
+
+void ImageWriter::write(const std::string &path, std::vector<unsigned char> &rgb, int width, int height,
+                        ImageFormat format)
+{
+  {
+    // Hold the renderer back until a worker has finished an image
+    std::unique_lock<std::mutex> lock(mutex);
+    if (queued >= maxQueued)
+    {
+      uint64_t start = traceNow();
+      TRACE_SCOPE("wait for encoder");
+      done.wait(lock, [this] { return queued < maxQueued; });
+      blockedTime += traceNow() - start;
+    }
+    ++queued;
+  }
+
+  // Tasks must be copyable, the pixels are shared instead of copied
+  std::shared_ptr<std::vector<unsigned char> > pixels(new std::vector<unsigned char>());
+  pixels->swap(rgb);
+  pool->submit([this, path, pixels, width, height, format] {
+    uint64_t start = traceNow();
+    if (writeImage(path, *pixels, width, height, format))
+      ++succeeded;
+    else
+      ++errors;
+    encodeTime += traceNow() - start;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    --queued;
+    done.notify_all();
+  });
+}
+
+void ImageWriter::wait()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [this] { return queued == 0; });
+}
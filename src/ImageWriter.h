@@ -0,0 +1,85 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// File formats for 8 bit RGB images stored from top to bottom
+enum ImageFormat
+{
+  // Binary portable pixmap, the pixels as they are
+  IMAGE_PPM,
+
+  // PNG with stored deflate blocks, readable everywhere and quick to
+  // write, but not compressed
+  IMAGE_PNG,
+
+  // Quite OK Image format, run length and small delta codes, usually
+  // less than half the size of PPM for rendered frames
+  IMAGE_QOI
+};
+
+// Name used on the command line and as the file extension, and the
+// reverse lookup. Unknown names return false.
+const char *imageFormatName(ImageFormat format);
+bool parseImageFormat(const std::string &name, ImageFormat &format);
+
+// Encode width x height RGB pixels into a file in memory
+void encodeImage(const std::vector<unsigned char> &rgb, int width, int height, ImageFormat format,
+                 std::vector<unsigned char> &file);
+
+// Encode and write an image, false with a message on error
+bool writeImage(const std::string &path, const std::vector<unsigned char> &rgb, int width, int height,
+                ImageFormat format);
+
+// Encodes and writes images on the workers of a pool while the caller goes
+// on rendering. The number of images queued is bounded, write blocks once
+// it is reached so that a slow disk cannot pile up frames in memory.
+class ImageWriter
+{
+public:
+  // Queue at most maxQueued images, 0 allows two per worker
+  explicit ImageWriter(ThreadPool *pool, size_t maxQueued = 0);
+
+  // Waits for the queued images
+  ~ImageWriter();
+
+  // Queue an image. The pixels are moved out of rgb, which is left empty.
+  void write(const std::string &path, std::vector<unsigned char> &rgb, int width, int height,
+             ImageFormat format);
+
+  // Block until every queued image has been written
+  void wait();
+
+  // Images written and images that failed so far
+  unsigned int written() const { return succeeded.load(); }
+  unsigned int failed() const { return errors.load(); }
+
+  // Seconds spent encoding and writing summed over the workers, and spent
+  // by the caller blocked in write
+  double encodeSeconds() const { return encodeTime.load() * 1e-9; }
+  double blockedSeconds() const { return blockedTime * 1e-9; }
+
+private:
+  ImageWriter(const ImageWriter &);
+  ImageWriter &operator=(const ImageWriter &);
+
+  ThreadPool *pool;
+  size_t maxQueued;
+  size_t queued;
+  std::mutex mutex;
+  std::condition_variable done;
+
+  std::atomic<unsigned int> succeeded;
+  std::atomic<unsigned int> errors;
+  std::atomic<uint64_t> encodeTime;
+  uint64_t blockedTime;
+};
+
+#endif
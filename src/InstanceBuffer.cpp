@@ -0,0 +1,151 @@
+#include "InstanceBuffer.h"
+#include "GLState.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+void InstanceBuffer::init()
+{
+  glGenBuffers(1, &id);
+  check_gl_error();
+}
+
+void InstanceBuffer::markDirty(size_t slot)
+{
+  if (dirtyBegin == dirtyEnd)
+  {
+    dirtyBegin = slot;
+    dirtyEnd = slot + 1;
+  }
+  else
+  {
+    dirtyBegin = std::min(dirtyBegin, slot);
+    dirtyEnd = std::max(dirtyEnd, slot + 1);
+  }
+}
+
+void InstanceBuffer::add(const Transform *added, size_t count, GLuint *handles)
+{
+  if (count == 0)
+    return;
+  size_t first = transforms.size();
+  transforms.insert(transforms.end(), added, added + count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    GLuint handle;
+    if (!freeHandles.empty())
+    {
+      handle = freeHandles.back();
+      freeHandles.pop_back();
+    }
+    else
+    {
+      handle = (GLuint) slotOf.size();
+      slotOf.push_back(0);
+    }
+    slotOf[handle] = (GLuint) (first + i);
+    handleOf.push_back(handle);
+    if (handles)
+      handles[i] = handle;
+  }
+  markDirty(first);
+  markDirty(transforms.size() - 1);
+}
+
+void InstanceBuffer::remove(const GLuint *handles, size_t count)
+{
+  // The last instance moves into the hole so the buffer stays packed
+  for (size_t i = 0; i < count; ++i)
+  {
+    GLuint handle = handles[i];
+    if (!inUse(handle))
+    {
+      std::cerr << "Instance handle " << handle << " is not in use" << std::endl;
+      continue;
+    }
+    GLuint slot = slotOf[handle];
+    GLuint last = (GLuint) transforms.size() - 1;
+    if (slot != last)
+    {
+      transforms[slot] = transforms[last];
+      handleOf[slot] = handleOf[last];
+      slotOf[handleOf[slot]] = slot;
+      markDirty(slot);
+    }
+    transforms.pop_back();
+    handleOf.pop_back();
+    slotOf[handle] = freeSlot;
+    freeHandles.push_back(handle);
+  }
+  dirtyEnd = std::min(dirtyEnd, transforms.size());
+  if (dirtyBegin >= dirtyEnd)
+    dirtyBegin = dirtyEnd = 0;
+}
+
+void InstanceBuffer::update(const GLuint *handles, const Transform *updated, size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (!inUse(handles[i]))
+      continue;
+    GLuint slot = slotOf[handles[i]];
+    transforms[slot] = updated[i];
+    markDirty(slot);
+  }
+}
+
+void InstanceBuffer::clear()
+{
+  transforms.clear();
+  handleOf.clear();
+  slotOf.clear();
+  freeHandles.clear();
+  dirtyBegin = dirtyEnd = 0;
+}
+
+void InstanceBuffer::upload()
+{
+  assert(id != 0);
+  glState.bindBuffer(GL_ARRAY_BUFFER, id);
+  if (transforms.size() > capacity)
+  {
+    capacity = std::max(transforms.size(), capacity * 2);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(Transform) * capacity, 0, GL_DYNAMIC_DRAW);
+    dirtyBegin = 0;
+    dirtyEnd = transforms.size();
+  }
+  if (dirtyBegin < dirtyEnd)
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(Transform) * dirtyBegin,
+                    sizeof(Transform) * (dirtyEnd - dirtyBegin), transforms[dirtyBegin].data());
+  dirtyBegin = dirtyEnd = 0;
+  check_gl_error();
+}
+
+void InstanceBuffer::attach(GLint location)
+{
+  glState.bindBuffer(GL_ARRAY_BUFFER, id);
+  for (int i = 0; i < 4; ++i)
+  {
+    glEnableVertexAttribArray(location + i);
+    glVertexAttribPointer(location + i, 4, GL_FLOAT, GL_FALSE, sizeof(Transform),
+                          (void*)(i * 4 * sizeof(float)));
+    glVertexAttribDivisor(location + i, 1);
+  }
+  check_gl_error();
+}
+
+void InstanceBuffer::free()
+{
+  glDeleteBuffers(1, &id);
+  glState.forgetBuffer(id);
+  id = 0;
+  capacity = 0;
+  check_gl_error();
+}
+
+void setIdentityInstance(GLint location)
+{
+  for (int i = 0; i < 4; ++i)
+    glVertexAttrib4f(location + i, i == 0, i == 1, i == 2, i == 3);
+}
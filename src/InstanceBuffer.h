@@ -0,0 +1,79 @@
+#ifndef INSTANCEBUFFER_H
+#define INSTANCEBUFFER_H
+
+#include "Helpers.h"
+
+#include <vector>
+
+// Per instance model matrices kept in a vertex buffer and read by a mat4
+// vertex attribute that advances once per instance. Instances are addressed
+// by handles that stay valid until they are removed; the matrices stay
+// packed so that every instance in the buffer is drawn.
+class InstanceBuffer
+{
+public:
+  typedef unsigned int GLuint;
+  typedef int GLint;
+  typedef Eigen::Matrix<float, 4, 4, Eigen::DontAlign> Transform;
+
+  GLuint id;
+
+  InstanceBuffer() : id(0), capacity(0), dirtyBegin(0), dirtyEnd(0) {}
+
+  // Create the buffer
+  void init();
+
+  // Add count instances, writing their handles to handles if given
+  void add(const Transform *transforms, size_t count, GLuint *handles = 0);
+
+  // Remove count instances by handle. Handles that are not in use are
+  // reported and skipped.
+  void remove(const GLuint *handles, size_t count);
+
+  // Replace the transforms of count instances, skipping handles that are
+  // not in use
+  void update(const GLuint *handles, const Transform *transforms, size_t count);
+
+  // Remove all instances
+  void clear();
+
+  // Number of instances
+  size_t size() const { return transforms.size(); }
+
+  // Upload the instances changed since the last upload. The buffer grows
+  // geometrically; within its capacity only the changed range is written.
+  void upload();
+
+  // Point the four vec4 attributes starting at location of the bound VAO at
+  // this buffer, advancing once per instance
+  void attach(GLint location);
+
+  // Release the buffer
+  void free();
+
+private:
+  void markDirty(size_t slot);
+  bool inUse(GLuint handle) const { return handle < slotOf.size() && slotOf[handle] != freeSlot; }
+
+  // Packed transforms and the handle of each slot
+  std::vector<Transform> transforms;
+  std::vector<GLuint> handleOf;
+
+  // Slot of each handle, freeSlot for removed handles, and handles free
+  // for reuse
+  static const GLuint freeSlot = ~0u;
+  std::vector<GLuint> slotOf;
+  std::vector<GLuint> freeHandles;
+
+  // Instances the GPU buffer has room for
+  size_t capacity;
+
+  // Slots changed since the last upload
+  size_t dirtyBegin, dirtyEnd;
+};
+
+// Make the generic values of the four instance attributes at location an
+// identity matrix, for drawing without an instance buffer attached
+void setIdentityInstance(GLint location);
+
+#endif
@@ -0,0 +1,730 @@
+#include "Mesh.h"
+#include "ThreadPool.h"
+#include "Meshlet.h"
+#include "Trace.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+
+#ifdef _WIN32
+#  include <windows.h>
+#  undef max
+#  undef min
+#else
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+
+MappedFile::MappedFile() : data(0), size(0)
+#ifdef _WIN32
+  , file(0), mapping(0)
+#else
+  , fd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string &path)
+{
+  close();
+  HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (f == INVALID_HANDLE_VALUE)
+    return false;
+  file = f;
+
+  LARGE_INTEGER length;
+  if (!GetFileSizeEx(f, &length))
+  {
+    close();
+    return false;
+  }
+  size = (size_t) length.QuadPart;
+  if (size == 0)
+    return true;
+
+  mapping = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!mapping)
+  {
+    close();
+    return false;
+  }
+  data = (const char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!data)
+  {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void MappedFile::close()
+{
+  if (data)
+    UnmapViewOfFile(data);
+  if (mapping)
+    CloseHandle(mapping);
+  if (file)
+    CloseHandle(file);
+  data = 0;
+  size = 0;
+  mapping = 0;
+  file = 0;
+}
+
+#else
+
+bool MappedFile::open(const std::string &path)
+{
+  close();
+  fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    close();
+    return false;
+  }
+  size = (size_t) st.st_size;
+  if (size == 0)
+    return true;
+
+  void *p = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED)
+  {
+    close();
+    return false;
+  }
+  madvise(p, size, MADV_SEQUENTIAL);
+  data = (const char *) p;
+  return true;
+}
+
+void MappedFile::close()
+{
+  if (data)
+    munmap((void *) data, size);
+  if (fd >= 0)
+    ::close(fd);
+  data = 0;
+  size = 0;
+  fd = -1;
+}
+
+#endif
+
+namespace
+{
+
+// Cursor over the mapped text. Comments (#) and whitespace are skipped
+// before every token, numbers are parsed without copying.
+class Scanner
+{
+public:
+  const char *p;
+  const char *end;
+
+  Scanner(const char *begin, const char *end) : p(begin), end(end) {}
+
+  void skip()
+  {
+    while (p < end)
+    {
+      if (*p == '#')
+        while (p < end && *p != '\n')
+          ++p;
+      else if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+        ++p;
+      else
+        break;
+    }
+  }
+
+  bool readWord(const char *word)
+  {
+    skip();
+    const char *q = p;
+    while (*word)
+    {
+      if (q == end || *q != *word)
+        return false;
+      ++q;
+      ++word;
+    }
+    p = q;
+    return true;
+  }
+
+  bool readInt(long &value)
+  {
+    skip();
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+      negative = (*p++ == '-');
+    if (p == end || *p < '0' || *p > '9')
+      return false;
+    long v = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+      v = v * 10 + (*p++ - '0');
+    value = negative ? -v : v;
+    return true;
+  }
+
+  bool readFloat(float &value)
+  {
+    static const double powers[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+      1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+      1e21, 1e22
+    };
+
+    skip();
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+      negative = (*p++ == '-');
+
+    // Up to 19 significant digits are accumulated exactly, the rest only
+    // shift the exponent
+    unsigned long long mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+      if (digits < 19)
+      {
+        mantissa = mantissa * 10 + (*p - '0');
+        if (mantissa)
+          ++digits;
+      }
+      else
+        ++exponent;
+      ++p;
+      any = true;
+    }
+    if (p < end && *p == '.')
+    {
+      ++p;
+      while (p < end && *p >= '0' && *p <= '9')
+      {
+        if (digits < 19)
+        {
+          mantissa = mantissa * 10 + (*p - '0');
+          if (mantissa)
+            ++digits;
+          --exponent;
+        }
+        ++p;
+        any = true;
+      }
+    }
+    if (!any)
+      return false;
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+      ++p;
+      bool negativeExp = false;
+      if (p < end && (*p == '-' || *p == '+'))
+        negativeExp = (*p++ == '-');
+      if (p == end || *p < '0' || *p > '9')
+        return false;
+      int e = 0;
+      while (p < end && *p >= '0' && *p <= '9')
+      {
+        if (e < 10000)
+          e = e * 10 + (*p - '0');
+        ++p;
+      }
+      exponent += negativeExp ? -e : e;
+    }
+
+    double v = (double) mantissa;
+    if (exponent < 0)
+      v = (exponent >= -22) ? v / powers[-exponent] : v * std::pow(10.0, exponent);
+    else if (exponent > 0)
+      v = (exponent <= 22) ? v * powers[exponent] : v * std::pow(10.0, exponent);
+    value = (float) (negative ? -v : v);
+    return true;
+  }
+};
+
+}
+
+namespace
+{
+
+// Files below this size are parsed as a single chunk
+const size_t minParallelSize = 1 << 20;
+
+// Upper bound for the chunk size, keeps progress and cancellation responsive
+const size_t maxChunkSize = 4 << 20;
+
+// A newline aligned slice of the vertex and face sections. Every non empty,
+// non comment line is one record: records [0, nv) are vertices, the next nf
+// are faces.
+struct Chunk
+{
+  const char *begin;
+  const char *end;
+  size_t records;
+  size_t firstRecord;
+  size_t triangles;
+  size_t firstTriangle;
+  bool failed;
+  size_t failedRecord;
+};
+
+const char *lineEnd(const char *p, const char *end)
+{
+  const char *q = (const char *) memchr(p, '\n', end - p);
+  return q ? q : end;
+}
+
+bool isRecord(const char *p, const char *eol)
+{
+  while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r'))
+    ++p;
+  return p < eol && *p != '#';
+}
+
+size_t countRecords(const char *p, const char *end)
+{
+  size_t n = 0;
+  while (p < end)
+  {
+    const char *eol = lineEnd(p, end);
+    if (isRecord(p, eol))
+      ++n;
+    p = eol + 1;
+  }
+  return n;
+}
+
+// Visit the records of chunk c, passing the global record index
+template <typename F>
+void forEachRecord(Chunk &c, F visit)
+{
+  size_t record = c.firstRecord;
+  const char *p = c.begin;
+  while (p < c.end)
+  {
+    const char *eol = lineEnd(p, c.end);
+    if (isRecord(p, eol))
+    {
+      if (!visit(record, p, eol))
+      {
+        c.failed = true;
+        c.failedRecord = record;
+        return;
+      }
+      ++record;
+    }
+    p = eol + 1;
+  }
+}
+
+}
+
+bool loadOFF(const std::string &path, OffMesh &mesh, ThreadPool *pool, LoadStatus *status)
+{
+  using namespace std;
+  TRACE_SCOPE("loadOFF");
+
+  MappedFile file;
+  if (!file.open(path))
+  {
+    cerr << "Cannot open mesh: " << path << endl;
+    return false;
+  }
+
+  const char *end = file.data + file.size;
+  Scanner in(file.data, end);
+
+  // Header: the OFF keyword followed by the vertex, face and edge counts
+  long nv, nf, ne;
+  if (!in.readWord("OFF") || !in.readInt(nv) || !in.readInt(nf) || !in.readInt(ne)
+      || nv < 0 || nf < 0)
+  {
+    cerr << "Invalid OFF header: " << path << endl;
+    return false;
+  }
+  const char *body = lineEnd(in.p, end);
+  if (body < end)
+    ++body;
+
+  // Split the body into newline aligned chunks of about the same size
+  size_t chunkCount = file.size / maxChunkSize + 1;
+  if (pool && file.size >= minParallelSize)
+    chunkCount = max(chunkCount, (size_t) pool->size() * 4);
+  vector<Chunk> chunks;
+  const char *p = body;
+  for (size_t i = 0; i < chunkCount && p < end; ++i)
+  {
+    const char *q = (i + 1 == chunkCount) ? end : p + (end - body) / chunkCount;
+    if (q < end)
+      q = lineEnd(q, end);
+    if (q < end)
+      ++q;
+    Chunk c;
+    memset(&c, 0, sizeof(c));
+    c.begin = p;
+    c.end = q;
+    chunks.push_back(c);
+    p = q;
+  }
+
+  // Run one pass over all chunks. Parsing a chunk is weighted as four
+  // counting passes when reporting progress.
+  atomic<size_t> done(0);
+  const size_t total = chunks.size() * 6;
+  function<bool(size_t, const function<void(size_t)> &)> run =
+    [&](size_t weight, const function<void(size_t)> &fn)
+    {
+      function<void(size_t)> task = [&](size_t i)
+      {
+        if (status && status->cancelled)
+          return;
+        TRACE_SCOPE("OFF chunk");
+        fn(i);
+        if (status)
+          status->progress = float(done += weight) / total;
+      };
+      if (pool && chunks.size() > 1)
+        pool->parallelFor(chunks.size(), task);
+      else
+        for (size_t i = 0; i < chunks.size(); ++i)
+          task(i);
+      return !(status && status->cancelled);
+    };
+
+  // Pass 1: count the records of each chunk to find where each one starts
+  if (!run(1, [&](size_t i) { chunks[i].records = countRecords(chunks[i].begin, chunks[i].end); }))
+    return false;
+  size_t records = 0;
+  for (size_t i = 0; i < chunks.size(); ++i)
+  {
+    chunks[i].firstRecord = records;
+    records += chunks[i].records;
+  }
+  if (records < (size_t) (nv + nf))
+  {
+    cerr << "Truncated OFF file: " << path << endl;
+    return false;
+  }
+
+  // Pass 2: count the triangles each chunk produces to find its output slice
+  const size_t firstFace = nv, lastFace = nv + nf;
+  bool counted = run(1, [&](size_t i)
+  {
+    Chunk &c = chunks[i];
+    if (c.firstRecord + c.records <= firstFace || c.firstRecord >= lastFace)
+      return;
+    forEachRecord(c, [&](size_t record, const char *line, const char *eol)
+    {
+      if (record < firstFace || record >= lastFace)
+        return true;
+      Scanner face(line, eol);
+      long n;
+      if (!face.readInt(n) || n < 3)
+        return false;
+      c.triangles += n - 2;
+      return true;
+    });
+  });
+  if (!counted)
+    return false;
+  size_t triangles = 0;
+  for (size_t i = 0; i < chunks.size(); ++i)
+  {
+    chunks[i].firstTriangle = triangles;
+    triangles += chunks[i].triangles;
+  }
+
+  mesh.V.resize(3, nv);
+  mesh.F.resize(triangles * 3);
+  float *V = mesh.V.data();
+  unsigned int *F = mesh.F.data();
+
+  // Pass 3: parse every record into its preallocated slot
+  bool parsed = run(4, [&](size_t i)
+  {
+    Chunk &c = chunks[i];
+    if (c.failed)
+      return;
+    unsigned int *f = F + c.firstTriangle * 3;
+    forEachRecord(c, [&](size_t record, const char *line, const char *eol)
+    {
+      Scanner in(line, eol);
+      if (record < firstFace)
+      {
+        float *v = V + record * 3;
+        return in.readFloat(v[0]) && in.readFloat(v[1]) && in.readFloat(v[2]);
+      }
+      if (record >= lastFace)
+        return true;
+
+      long n, first, previous, current;
+      if (!in.readInt(n) || !in.readInt(first) || !in.readInt(previous)
+          || first < 0 || first >= nv || previous < 0 || previous >= nv)
+        return false;
+      for (long k = 2; k < n; ++k)
+      {
+        if (!in.readInt(current) || current < 0 || current >= nv)
+          return false;
+        *f++ = (unsigned int) first;
+        *f++ = (unsigned int) previous;
+        *f++ = (unsigned int) current;
+        previous = current;
+      }
+      return true;
+    });
+  });
+  if (!parsed)
+    return false;
+
+  // Report the first error in file order
+  for (size_t i = 0; i < chunks.size(); ++i)
+  {
+    if (!chunks[i].failed)
+      continue;
+    size_t record = chunks[i].failedRecord;
+    if (record < firstFace)
+      cerr << "Invalid vertex " << record << " in " << path << endl;
+    else
+      cerr << "Invalid face " << record - firstFace << " in " << path << endl;
+    return false;
+  }
+
+  return true;
+}
+
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed)
+{
+  // Word at a time multiply/xorshift mix, fast enough to run on every cache
+  // validation of a multi-hundred-MB source
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const unsigned char *p = (const unsigned char *) data;
+  uint64_t h = seed ^ (size * m);
+
+  size_t words = size / 8;
+  for (size_t i = 0; i < words; ++i)
+  {
+    uint64_t k;
+    memcpy(&k, p + i * 8, 8);
+    k *= m;
+    k ^= k >> 47;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+
+  uint64_t tail = 0;
+  if (size % 8)
+    memcpy(&tail, p + words * 8, size % 8);
+  h ^= tail;
+  h *= m;
+
+  h ^= h >> 47;
+  h *= m;
+  h ^= h >> 47;
+  return h;
+}
+
+namespace
+{
+
+const char cacheMagic[4] = { 'M', 'S', 'H', 'C' };
+const uint32_t cacheVersion = 3;
+
+bool statFile(const std::string &path, uint64_t &size, int64_t &time)
+{
+#ifdef _WIN32
+  struct _stat64 st;
+  if (_stat64(path.c_str(), &st) != 0)
+    return false;
+#else
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return false;
+#endif
+  // Nanosecond resolution where available so an edit within the same second
+  // as the cache write still forces a hash check
+  size = (uint64_t) st.st_size;
+#if defined(_WIN32)
+  time = (int64_t) st.st_mtime * 1000000000;
+#elif defined(__APPLE__)
+  time = (int64_t) st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+  time = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+  return true;
+}
+
+// A temporary file next to cachePath that no other writer uses, in this or
+// another process, so concurrent imports of one mesh never share it
+std::string uniqueTempPath(const std::string &cachePath)
+{
+  static std::atomic<unsigned int> counter(0);
+#ifdef _WIN32
+  unsigned long pid = (unsigned long) GetCurrentProcessId();
+#else
+  unsigned long pid = (unsigned long) getpid();
+#endif
+  std::ostringstream path;
+  path << cachePath << "." << pid << "." << counter++ << ".tmp";
+  return path.str();
+}
+
+// Store a new source mtime in the header of a cache, in place. Failing only
+// costs another hash check on the next open.
+void updateCacheSourceTime(const std::string &cachePath, int64_t sourceTime)
+{
+  std::fstream out(cachePath.c_str(), std::ios::binary | std::ios::in | std::ios::out);
+  out.seekp(offsetof(MeshCacheHeader, sourceTime));
+  out.write((const char *) &sourceTime, sizeof(sourceTime));
+}
+
+}
+
+bool MeshCache::open(const std::string &cachePath, const std::string &sourcePath, uint64_t params)
+{
+  close();
+
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  if (!statFile(sourcePath, sourceSize, sourceTime) || !file.open(cachePath))
+    return false;
+
+  const MeshCacheHeader *h = (const MeshCacheHeader *) file.data;
+  if (file.size < sizeof(MeshCacheHeader) || memcmp(h->magic, cacheMagic, 4) != 0
+      || h->version != cacheVersion || h->params != params || h->sourceSize != sourceSize)
+  {
+    close();
+    return false;
+  }
+
+  size_t expected = sizeof(MeshCacheHeader)
+                  + sizeof(float) * (size_t) h->rows * h->vertices
+                  + sizeof(unsigned int) * (size_t) h->indices
+                  + sizeof(MeshLevel) * (size_t) h->levels
+                  + sizeof(Meshlet) * (size_t) h->meshlets;
+  if (file.size != expected)
+  {
+    close();
+    return false;
+  }
+
+  // A changed mtime alone does not invalidate the cache (e.g. after a fresh
+  // checkout), only a change of content does. The new mtime is recorded so
+  // that later opens skip the hash again.
+  if (h->sourceTime != sourceTime)
+  {
+    MappedFile source;
+    if (!source.open(sourcePath) || hashBytes(source.data, source.size) != h->sourceHash)
+    {
+      close();
+      return false;
+    }
+    updateCacheSourceTime(cachePath, sourceTime);
+  }
+
+  header = h;
+  vertices = (const float *) (file.data + sizeof(MeshCacheHeader));
+  indices = (const unsigned int *) (vertices + (size_t) h->rows * h->vertices);
+  levels = (const MeshLevel *) (indices + h->indices);
+  meshlets = (const Meshlet *) (levels + h->levels);
+  return true;
+}
+
+void MeshCache::close()
+{
+  file.close();
+  header = 0;
+  vertices = 0;
+  indices = 0;
+  levels = 0;
+  meshlets = 0;
+}
+
+bool writeMeshCache(const std::string &cachePath, const std::string &sourcePath, uint64_t params,
+                    const Eigen::MatrixXf &V, const std::vector<unsigned int> &F,
+                    const std::vector<MeshLevel> &levels, const std::vector<Meshlet> &meshlets)
+{
+  using namespace std;
+
+  MeshCacheHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, cacheMagic, 4);
+  h.version = cacheVersion;
+  h.rows = (uint32_t) V.rows();
+  h.vertices = (uint32_t) V.cols();
+  h.indices = (uint32_t) F.size();
+  h.levels = (uint32_t) levels.size();
+  h.meshlets = (uint32_t) meshlets.size();
+  h.params = params;
+
+  MappedFile source;
+  if (!statFile(sourcePath, h.sourceSize, h.sourceTime) || !source.open(sourcePath))
+    return false;
+  h.sourceHash = hashBytes(source.data, source.size);
+  source.close();
+
+  if (V.cols() > 0)
+  {
+    Eigen::Vector3f lo = V.topRows(3).rowwise().minCoeff();
+    Eigen::Vector3f hi = V.topRows(3).rowwise().maxCoeff();
+    for (int i = 0; i < 3; ++i)
+    {
+      h.bboxMin[i] = lo[i];
+      h.bboxMax[i] = hi[i];
+    }
+  }
+
+  string tmpPath = uniqueTempPath(cachePath);
+  {
+    ofstream out(tmpPath.c_str(), ios::binary | ios::trunc);
+    out.write((const char *) &h, sizeof(h));
+    out.write((const char *) V.data(), sizeof(float) * V.size());
+    out.write((const char *) F.data(), sizeof(unsigned int) * F.size());
+    out.write((const char *) levels.data(), sizeof(MeshLevel) * levels.size());
+    out.write((const char *) meshlets.data(), sizeof(Meshlet) * meshlets.size());
+    if (!out)
+    {
+      cerr << "Cannot write mesh cache: " << cachePath << endl;
+      out.close();
+      remove(tmpPath.c_str());
+      return false;
+    }
+  }
+
+#ifdef _WIN32
+  remove(cachePath.c_str());
+#endif
+  if (rename(tmpPath.c_str(), cachePath.c_str()) != 0)
+  {
+    cerr << "Cannot write mesh cache: " << cachePath << endl;
+    remove(tmpPath.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,141 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+#include <atomic>
+#include <Eigen/Core>
+
+class ThreadPool;
+struct Meshlet;
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+  const char *data;
+  size_t size;
+
+  MappedFile();
+  ~MappedFile();
+
+  // Map the file at path, returns false if it cannot be opened or mapped
+  bool open(const std::string &path);
+
+  // Unmap the file (called automatically on destruction)
+  void close();
+
+private:
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+
+#ifdef _WIN32
+  void *file;
+  void *mapping;
+#else
+  int fd;
+#endif
+};
+
+// Triangle mesh as stored in an OFF file
+class OffMesh
+{
+public:
+  // Vertex positions, one vertex per column (3xN)
+  Eigen::MatrixXf V;
+
+  // Triangle indices, three per triangle. Polygons are fan triangulated.
+  std::vector<unsigned int> F;
+};
+
+// Progress of a load, shared between the loading thread and its observers
+class LoadStatus
+{
+public:
+  // Fraction of the work done, from 0 to 1
+  std::atomic<float> progress;
+
+  // Set to make the load stop early and fail
+  std::atomic<bool> cancelled;
+
+  LoadStatus() : progress(0), cancelled(false) {}
+};
+
+// Load the OFF file at path into mesh. The file is memory mapped and parsed
+// in place; on failure the reason is printed and false is returned. With a
+// pool, large files are split into newline aligned chunks parsed in
+// parallel; the result does not depend on the number of threads. If status
+// is given it receives the progress, and a cancelled load returns false.
+bool loadOFF(const std::string &path, OffMesh &mesh, ThreadPool *pool = 0, LoadStatus *status = 0);
+
+// 64 bit content hash used to validate caches against their source
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 0);
+
+// Range of an index buffer holding one level of detail, in indices.
+// error is the largest displacement of the surface from the full resolution
+// mesh, in the units of the vertex positions.
+struct MeshLevel
+{
+  uint32_t first;
+  uint32_t count;
+  float error;
+  uint32_t reserved;
+};
+
+// Fixed size header at the start of a binary mesh cache. It is followed by
+// the interleaved vertex block (rows floats per vertex), the index block
+// holding all levels of detail, the table of levels and the meshlet block
+// (see Meshlet.h).
+struct MeshCacheHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t rows;
+  uint32_t vertices;
+  uint32_t indices;
+  uint32_t levels;
+  uint32_t meshlets;
+  uint32_t reserved;
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  uint64_t sourceHash;
+  uint64_t params;
+  float bboxMin[3];
+  float bboxMax[3];
+};
+
+// Memory mapped view of a binary mesh cache. The pointers stay valid until
+// the cache is closed and can be handed to the GPU without copying.
+class MeshCache
+{
+public:
+  const MeshCacheHeader *header;
+  const float *vertices;
+  const unsigned int *indices;
+  const MeshLevel *levels;
+  const Meshlet *meshlets;
+
+  MeshCache() : header(0), vertices(0), indices(0), levels(0), meshlets(0) {}
+
+  // Map cachePath if it was written from the current contents of sourcePath
+  // with the same import params. Returns false if missing or stale.
+  bool open(const std::string &cachePath, const std::string &sourcePath, uint64_t params);
+
+  // Release the mapping
+  void close();
+
+private:
+  MappedFile file;
+};
+
+// Write V (one vertex per column), F, the levels of detail ranges of F and
+// the meshlets of F as the cache of sourcePath. The file is written to a
+// temporary name of its own and renamed, so readers never see it partial
+// and concurrent writers of the same cache do not clobber each other.
+bool writeMeshCache(const std::string &cachePath, const std::string &sourcePath, uint64_t params,
+                    const Eigen::MatrixXf &V, const std::vector<unsigned int> &F,
+                    const std::vector<MeshLevel> &levels, const std::vector<Meshlet> &meshlets);
+
+#endif
@@ -0,0 +1,214 @@
+#include "MeshLoader.h"
+#include "Trace.h"
+
+#include <cstdio>
+#include <algorithm>
+
+uint64_t ImportSettings::hash() const
+{
+  const float params[8] = { scale, shift[0], shift[1], shift[2], vertexHasColor(format) ? 1.0f : 0.0f,
+                            float(optimization), float(levels), meshlets ? 1.0f : 0.0f };
+  return hashBytes(params, sizeof(params));
+}
+
+namespace
+{
+
+// Whether the load was cancelled, checked between the stages of an import
+bool cancelled(const LoadStatus *status)
+{
+  return status && status->cancelled;
+}
+
+}
+
+bool importMesh(const std::string &path, const ImportSettings &settings, MeshData &mesh,
+                ThreadPool *pool, LoadStatus *status)
+{
+  TRACE_SCOPE("importMesh");
+  const uint64_t params = settings.hash();
+  const std::string cachePath = path + ".cache";
+  mesh.path = path;
+
+  // Fast path: point straight into the mapped cache
+  if (mesh.cache.open(cachePath, path, params))
+  {
+    mesh.vertices = mesh.cache.vertices;
+    mesh.rows = mesh.cache.header->rows;
+    mesh.cols = mesh.cache.header->vertices;
+    mesh.indices = mesh.cache.indices;
+    mesh.count = mesh.cache.header->indices;
+    mesh.levels.assign(mesh.cache.levels, mesh.cache.levels + mesh.cache.header->levels);
+    mesh.meshlets.assign(mesh.cache.meshlets, mesh.cache.meshlets + mesh.cache.header->meshlets);
+    packVertices(mesh.vertices, mesh.rows, mesh.cols, settings.format, mesh.packed);
+    if (status)
+      status->progress = 1;
+    return true;
+  }
+
+  OffMesh off;
+  if (!loadOFF(path, off, pool, status))
+    return false;
+
+  // Scale and move the model into view, color is the squared position.
+  // Position only formats compute the color on the GPU instead.
+  mesh.V.resize(vertexHasColor(settings.format) ? 6 : 3, off.V.cols());
+  mesh.V.topRows(3) = (off.V * settings.scale).colwise() + settings.shift;
+  if (mesh.V.rows() == 6)
+    mesh.V.bottomRows(3) = mesh.V.topRows(3).array().square();
+  mesh.F.swap(off.F);
+
+  // Reorder once here, the cache keeps the optimized order
+  CacheStats before, after;
+  if (settings.optimization != OPTIMIZE_NONE)
+  {
+    TRACE_SCOPE("optimizeMesh");
+    optimizeMesh(mesh.V, mesh.F, settings.optimization, before, after);
+  }
+  if (cancelled(status))
+    return false;
+
+  // Simplified levels share the vertices and follow the full mesh in F.
+  // They get the same triangle order optimization.
+  {
+    TRACE_SCOPE("buildLevels");
+    buildLevels(mesh.V, mesh.F, settings.levels, mesh.levels);
+  }
+  for (size_t i = 1; i < mesh.levels.size() && settings.optimization != OPTIMIZE_NONE && !cancelled(status); ++i)
+  {
+    std::vector<unsigned int> level(mesh.F.begin() + mesh.levels[i].first,
+                                    mesh.F.begin() + mesh.levels[i].first + mesh.levels[i].count);
+    optimizeVertexCache(level, mesh.V.cols());
+    std::copy(level.begin(), level.end(), mesh.F.begin() + mesh.levels[i].first);
+  }
+  if (cancelled(status))
+    return false;
+  for (size_t i = 1; i < mesh.levels.size(); ++i)
+    printf("Level %u of %s: %u triangles, error %g\n", (unsigned) i, path.c_str(),
+           mesh.levels[i].count / 3, mesh.levels[i].error);
+
+  // Meshlets regroup the triangles within each level last, then get the
+  // optimization back within and across meshlets
+  if (settings.meshlets)
+  {
+    TRACE_SCOPE("buildMeshlets");
+    buildMeshlets(mesh.V, mesh.F, mesh.levels, mesh.meshlets);
+    if (cancelled(status))
+      return false;
+    optimizeMeshlets(mesh.V, mesh.F, mesh.levels, mesh.meshlets, settings.optimization);
+    printf("Split %s into %u meshlets\n", path.c_str(), (unsigned) mesh.meshlets.size());
+  }
+  if (cancelled(status))
+    return false;
+
+  // Report on the full mesh as it is uploaded
+  if (settings.optimization != OPTIMIZE_NONE)
+  {
+    size_t full = mesh.levels.empty() ? mesh.F.size() : mesh.levels[0].count;
+    after = analyzeVertexCache(mesh.F.data(), full, mesh.V.cols());
+    printf("Optimized %s (%s): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", path.c_str(),
+           meshOptimizationName(settings.optimization), before.acmr, after.acmr, before.atvr, after.atvr);
+  }
+
+  mesh.vertices = mesh.V.data();
+  mesh.rows = mesh.V.rows();
+  mesh.cols = mesh.V.cols();
+  mesh.indices = mesh.F.data();
+  mesh.count = mesh.F.size();
+  packVertices(mesh.vertices, mesh.rows, mesh.cols, settings.format, mesh.packed);
+
+  TRACE_SCOPE("writeMeshCache");
+  writeMeshCache(cachePath, path, params, mesh.V, mesh.F, mesh.levels, mesh.meshlets);
+  return true;
+}
+
+MeshLoader::MeshLoader(ThreadPool *pool)
+  : pool(pool), stopping(false), hasRequest(false), current(0)
+{
+  worker = std::thread(&MeshLoader::run, this);
+}
+
+MeshLoader::~MeshLoader()
+{
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    stopping = true;
+    hasRequest = false;
+    if (current)
+      current->cancelled = true;
+  }
+  wake.notify_all();
+  worker.join();
+}
+
+void MeshLoader::request(const std::string &path, const ImportSettings &settings)
+{
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    hasRequest = true;
+    requestPath = path;
+    requestSettings = settings;
+    if (current)
+      current->cancelled = true;
+    result.reset();
+  }
+  wake.notify_all();
+}
+
+void MeshLoader::cancel()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  hasRequest = false;
+  if (current)
+    current->cancelled = true;
+  result.reset();
+}
+
+bool MeshLoader::busy()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  return hasRequest || current;
+}
+
+float MeshLoader::progress()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  if (hasRequest)
+    return 0;
+  return current ? current->progress.load() : 1;
+}
+
+std::unique_ptr<MeshData> MeshLoader::poll()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  return std::move(result);
+}
+
+void MeshLoader::run()
+{
+  setTraceThreadName("mesh loader");
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;)
+  {
+    while (!stopping && !hasRequest)
+      wake.wait(lock);
+    if (stopping)
+      return;
+
+    std::string path = requestPath;
+    ImportSettings settings = requestSettings;
+    hasRequest = false;
+
+    LoadStatus status;
+    current = &status;
+    lock.unlock();
+
+    std::unique_ptr<MeshData> mesh(new MeshData());
+    bool loaded = importMesh(path, settings, *mesh, pool, &status);
+
+    lock.lock();
+    current = 0;
+    if (loaded && !status.cancelled)
+      result = std::move(mesh);
+  }
+}
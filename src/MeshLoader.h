@@ -0,0 +1,139 @@
+#ifndef MESHLOADER_H
+#define MESHLOADER_H
+
+#include "Mesh.h"
+#include "VertexFormat.h"
+#include "MeshOptimizer.h"
+#include "Simplify.h"
+#include "Meshlet.h"
+
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// How an OFF file is placed in the scene. The settings are baked into the
+// vertices and are part of the cache key.
+class ImportSettings
+{
+public:
+  // Uniform scale applied to the file positions
+  float scale;
+
+  // Translation applied after scaling
+  Eigen::Vector3f shift;
+
+  // GPU layout the vertices are packed into. The cache always stores
+  // floats, only whether colors are stored is part of its key.
+  VertexFormat format;
+
+  // Reordering applied after parsing, the result is cached
+  MeshOptimization optimization;
+
+  // Number of simplified levels of detail built below the full mesh
+  unsigned int levels;
+
+  // Split every level into meshlets for culling
+  bool meshlets;
+
+  ImportSettings(float scale = 1, const Eigen::Vector3f &shift = Eigen::Vector3f::Zero(),
+                 VertexFormat format = VERTEX_FLOAT, MeshOptimization optimization = OPTIMIZE_NONE,
+                 unsigned int levels = 0, bool meshlets = false)
+    : scale(scale), shift(shift), format(format), optimization(optimization), levels(levels),
+      meshlets(meshlets) {}
+
+  // Hash identifying the scale, shift, color storage, optimization, levels
+  // of detail and meshlets in a mesh cache
+  uint64_t hash() const;
+};
+
+// Interleaved vertices (position and, if the format has one, color) and
+// triangle indices ready to be uploaded. They either point into a mapped
+// cache or into V and F.
+class MeshData
+{
+public:
+  std::string path;
+
+  const float *vertices;
+  unsigned int rows;
+  unsigned int cols;
+  const unsigned int *indices;
+  unsigned int count;
+
+  // Ranges of indices holding each level of detail, the full mesh first
+  std::vector<MeshLevel> levels;
+
+  // Culling clusters covering all levels, empty if not requested
+  std::vector<Meshlet> meshlets;
+
+  // Owned buffers when the mesh was parsed
+  Eigen::MatrixXf V;
+  std::vector<unsigned int> F;
+
+  // Mapping when the mesh came from its cache
+  MeshCache cache;
+
+  // The vertices in the requested GPU format
+  PackedVertices packed;
+
+  MeshData() : vertices(0), rows(0), cols(0), indices(0), count(0) {}
+};
+
+// Load path through its cache, or parse it and write the cache. Runs on the
+// calling thread; pool and status are passed on to loadOFF. A cancelled
+// status also stops the import between its later stages, returning false
+// without writing the cache.
+bool importMesh(const std::string &path, const ImportSettings &settings, MeshData &mesh,
+                ThreadPool *pool = 0, LoadStatus *status = 0);
+
+// Imports meshes on a background thread, one at a time. A new request
+// cancels the one in flight, finished meshes are collected with poll().
+class MeshLoader
+{
+public:
+  // pool is used for parsing, it can be 0
+  explicit MeshLoader(ThreadPool *pool = 0);
+
+  // Cancel the current load and join the worker
+  ~MeshLoader();
+
+  // Start importing path, cancelling any load in flight
+  void request(const std::string &path, const ImportSettings &settings);
+
+  // Cancel the current and pending loads
+  void cancel();
+
+  // True while a load is pending or running
+  bool busy();
+
+  // Progress of the current load from 0 to 1
+  float progress();
+
+  // Take the last finished mesh, or an empty pointer if there is none
+  std::unique_ptr<MeshData> poll();
+
+private:
+  MeshLoader(const MeshLoader &);
+  MeshLoader &operator=(const MeshLoader &);
+
+  void run();
+
+  ThreadPool *pool;
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping;
+
+  // Next load to start, if any
+  bool hasRequest;
+  std::string requestPath;
+  ImportSettings requestSettings;
+
+  // Load currently running on the worker, 0 when idle
+  LoadStatus *current;
+
+  std::unique_ptr<MeshData> result;
+};
+
+#endif
@@ -0,0 +1,257 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <Eigen/Geometry>
+
+const char *meshOptimizationName(MeshOptimization optimization)
+{
+  switch (optimization)
+  {
+    case OPTIMIZE_CACHE:    return "cache";
+    case OPTIMIZE_OVERDRAW: return "overdraw";
+    default:                return "none";
+  }
+}
+
+bool parseMeshOptimization(const std::string &name, MeshOptimization &optimization)
+{
+  if (name == "none")
+    optimization = OPTIMIZE_NONE;
+  else if (name == "cache")
+    optimization = OPTIMIZE_CACHE;
+  else if (name == "overdraw")
+    optimization = OPTIMIZE_OVERDRAW;
+  else
+    return false;
+  return true;
+}
+
+CacheStats analyzeVertexCache(const unsigned int *indices, size_t count, size_t vertices,
+                              unsigned int cacheSize)
+{
+  CacheStats stats;
+  if (count < 3)
+    return stats;
+
+  // Each vertex remembers when it entered the FIFO, it is still cached
+  // if fewer than cacheSize misses happened since
+  std::vector<size_t> entered(vertices, 0);
+  std::vector<bool> used(vertices, false);
+  size_t misses = 0, referenced = 0;
+  for (size_t i = 0; i < count; ++i)
+  {
+    unsigned int v = indices[i];
+    if (!used[v])
+    {
+      used[v] = true;
+      ++referenced;
+    }
+    if (entered[v] == 0 || misses - entered[v] >= cacheSize)
+    {
+      ++misses;
+      entered[v] = misses;
+    }
+  }
+
+  stats.acmr = float(misses) / (count / 3);
+  stats.atvr = float(misses) / referenced;
+  return stats;
+}
+
+void optimizeVertexCache(std::vector<unsigned int> &indices, size_t vertices,
+                         unsigned int cacheSize, std::vector<unsigned int> *clusters)
+{
+  const size_t triangles = indices.size() / 3;
+  if (clusters)
+    clusters->clear();
+  if (triangles == 0)
+    return;
+
+  // Vertex to triangle adjacency in compressed rows
+  std::vector<unsigned int> live(vertices, 0);
+  for (size_t i = 0; i < indices.size(); ++i)
+    ++live[indices[i]];
+  std::vector<size_t> offsets(vertices + 1, 0);
+  for (size_t v = 0; v < vertices; ++v)
+    offsets[v + 1] = offsets[v] + live[v];
+  std::vector<unsigned int> adjacency(indices.size());
+  std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+  for (size_t t = 0; t < triangles; ++t)
+    for (int k = 0; k < 3; ++k)
+      adjacency[fill[indices[t * 3 + k]]++] = (unsigned int) t;
+
+  std::vector<size_t> cacheTime(vertices, 0);
+  std::vector<bool> emitted(triangles, false);
+  std::vector<unsigned int> deadEnd;
+  std::vector<unsigned int> candidates;
+  std::vector<unsigned int> output;
+  output.reserve(indices.size());
+
+  size_t time = cacheSize + 1;
+  size_t cursor = 0;
+  long fan = 0;
+  while (fan >= 0)
+  {
+    // Emit every remaining triangle around the fanning vertex
+    candidates.clear();
+    for (size_t a = offsets[fan]; a < offsets[fan + 1]; ++a)
+    {
+      unsigned int t = adjacency[a];
+      if (emitted[t])
+        continue;
+      emitted[t] = true;
+      for (int k = 0; k < 3; ++k)
+      {
+        unsigned int v = indices[t * 3 + k];
+        output.push_back(v);
+        deadEnd.push_back(v);
+        candidates.push_back(v);
+        --live[v];
+        if (time - cacheTime[v] > cacheSize)
+          cacheTime[v] = time++;
+      }
+    }
+
+    // Next fan: the candidate that stays longest in the cache while still
+    // having triangles left
+    long next = -1;
+    long best = -1;
+    for (size_t c = 0; c < candidates.size(); ++c)
+    {
+      unsigned int v = candidates[c];
+      if (live[v] == 0)
+        continue;
+      long priority = 0;
+      if (time - cacheTime[v] + 2 * live[v] <= cacheSize)
+        priority = (long) (time - cacheTime[v]);
+      if (priority > best)
+      {
+        best = priority;
+        next = v;
+      }
+    }
+
+    // Dead end: back up through recently used vertices, then scan forward
+    if (next < 0)
+    {
+      while (!deadEnd.empty() && next < 0)
+      {
+        unsigned int v = deadEnd.back();
+        deadEnd.pop_back();
+        if (live[v] > 0)
+          next = v;
+      }
+      while (next < 0 && cursor < vertices)
+      {
+        if (live[cursor] > 0)
+          next = (long) cursor;
+        ++cursor;
+      }
+      if (next >= 0 && clusters)
+        clusters->push_back((unsigned int) (output.size() / 3));
+    }
+    fan = next;
+  }
+
+  if (clusters && (clusters->empty() || clusters->front() != 0))
+    clusters->insert(clusters->begin(), 0);
+  indices.swap(output);
+}
+
+void optimizeOverdraw(std::vector<unsigned int> &indices, const Eigen::MatrixXf &V,
+                      const std::vector<unsigned int> &clusters)
+{
+  const size_t triangles = indices.size() / 3;
+  if (clusters.size() < 2)
+    return;
+
+  // Clusters facing away from the center and lying far out are drawn first
+  Eigen::Vector3f center = triangleCentroid(indices.data(), indices.size(), V);
+  std::vector<std::pair<float, size_t> > order(clusters.size());
+  for (size_t i = 0; i < clusters.size(); ++i)
+  {
+    size_t begin = clusters[i];
+    size_t end = i + 1 < clusters.size() ? clusters[i + 1] : triangles;
+    order[i] = std::make_pair(overdrawKey(&indices[begin * 3], (end - begin) * 3, V, center), i);
+  }
+  std::stable_sort(order.begin(), order.end());
+
+  std::vector<unsigned int> output;
+  output.reserve(indices.size());
+  for (size_t i = 0; i < order.size(); ++i)
+  {
+    size_t c = order[i].second;
+    size_t begin = clusters[c];
+    size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangles;
+    output.insert(output.end(), indices.begin() + begin * 3, indices.begin() + end * 3);
+  }
+  indices.swap(output);
+}
+
+Eigen::Vector3f triangleCentroid(const unsigned int *indices, size_t count, const Eigen::MatrixXf &V)
+{
+  Eigen::Vector3f center = Eigen::Vector3f::Zero();
+  float totalArea = 0;
+  for (size_t t = 0; t + 2 < count; t += 3)
+  {
+    Eigen::Vector3f a = V.col(indices[t]).head<3>();
+    Eigen::Vector3f b = V.col(indices[t + 1]).head<3>();
+    Eigen::Vector3f c = V.col(indices[t + 2]).head<3>();
+    float area = (b - a).cross(c - a).norm();
+    center += area * (a + b + c) / 3;
+    totalArea += area;
+  }
+  if (totalArea > 0)
+    center /= totalArea;
+  return center;
+}
+
+float overdrawKey(const unsigned int *indices, size_t count, const Eigen::MatrixXf &V,
+                  const Eigen::Vector3f &center)
+{
+  Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+  for (size_t t = 0; t + 2 < count; t += 3)
+  {
+    Eigen::Vector3f a = V.col(indices[t]).head<3>();
+    normal += (V.col(indices[t + 1]).head<3>() - a).cross(V.col(indices[t + 2]).head<3>() - a);
+  }
+  float length = normal.norm();
+  float key = length > 0 ? (triangleCentroid(indices, count, V) - center).dot(normal / length) : 0;
+  return -key;
+}
+
+void optimizeVertexFetch(Eigen::MatrixXf &V, std::vector<unsigned int> &indices)
+{
+  const unsigned int unused = ~0u;
+  std::vector<unsigned int> remap(V.cols(), unused);
+  unsigned int next = 0;
+  for (size_t i = 0; i < indices.size(); ++i)
+  {
+    unsigned int &r = remap[indices[i]];
+    if (r == unused)
+      r = next++;
+    indices[i] = r;
+  }
+
+  Eigen::MatrixXf reordered(V.rows(), next);
+  for (Eigen::Index v = 0; v < V.cols(); ++v)
+    if (remap[v] != unused)
+      reordered.col(remap[v]) = V.col(v);
+  V.swap(reordered);
+}
+
+void optimizeMesh(Eigen::MatrixXf &V, std::vector<unsigned int> &F, MeshOptimization optimization,
+                  CacheStats &before, CacheStats &after)
+{
+  before = analyzeVertexCache(F.data(), F.size(), V.cols());
+  if (optimization != OPTIMIZE_NONE)
+  {
+    std::vector<unsigned int> clusters;
+    optimizeVertexCache(F, V.cols(), vertexCacheSize,
+                        optimization == OPTIMIZE_OVERDRAW ? &clusters : 0);
+    if (optimization == OPTIMIZE_OVERDRAW)
+      optimizeOverdraw(F, V, clusters);
+    optimizeVertexFetch(V, F);
+  }
+  after = analyzeVertexCache(F.data(), F.size(), V.cols());
+}
@@ -0,0 +1,78 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <Eigen/Core>
+
+// Optimization stages applied to a mesh on import
+enum MeshOptimization
+{
+  // Keep the file order
+  OPTIMIZE_NONE,
+  // Reorder triangles for the vertex cache and vertices for fetch
+  OPTIMIZE_CACHE,
+  // As OPTIMIZE_CACHE, then sort triangle clusters to reduce overdraw
+  OPTIMIZE_OVERDRAW
+};
+
+// Name used on the command line
+const char *meshOptimizationName(MeshOptimization optimization);
+
+// Parse none, cache or overdraw, false if the name is unknown
+bool parseMeshOptimization(const std::string &name, MeshOptimization &optimization);
+
+// Post-transform vertex cache efficiency of an index buffer, simulated with
+// a FIFO cache
+class CacheStats
+{
+public:
+  // Average cache misses per triangle, 0.5 is ideal for large grids, 3 is
+  // the worst case
+  float acmr;
+
+  // Average cache misses per referenced vertex, 1 is ideal
+  float atvr;
+
+  CacheStats() : acmr(0), atvr(0) {}
+};
+
+// Size of the simulated post-transform cache
+const unsigned int vertexCacheSize = 16;
+
+// Simulate the vertex cache on count indices into vertices vertices
+CacheStats analyzeVertexCache(const unsigned int *indices, size_t count, size_t vertices,
+                              unsigned int cacheSize = vertexCacheSize);
+
+// Reorder the triangles of indices for vertex cache locality (Tipsify, Sander
+// et al. 2007). If clusters is given it receives the first triangle of every
+// run that starts after a dead end; the runs can be reordered freely.
+void optimizeVertexCache(std::vector<unsigned int> &indices, size_t vertices,
+                         unsigned int cacheSize = vertexCacheSize,
+                         std::vector<unsigned int> *clusters = 0);
+
+// Reorder the clusters found by optimizeVertexCache so that outward facing
+// clusters far from the center, which tend to occlude the others, are drawn
+// first. V holds one position per column in its first three rows.
+void optimizeOverdraw(std::vector<unsigned int> &indices, const Eigen::MatrixXf &V,
+                      const std::vector<unsigned int> &clusters);
+
+// Area weighted centroid of the triangles of count indices
+Eigen::Vector3f triangleCentroid(const unsigned int *indices, size_t count, const Eigen::MatrixXf &V);
+
+// Sort key of optimizeOverdraw for the cluster of count indices in a mesh
+// centered at center: clusters with lower keys are drawn first
+float overdrawKey(const unsigned int *indices, size_t count, const Eigen::MatrixXf &V,
+                  const Eigen::Vector3f &center);
+
+// Renumber the vertices in the order the triangles first use them so the
+// vertex fetch is sequential. Unreferenced vertices are dropped.
+void optimizeVertexFetch(Eigen::MatrixXf &V, std::vector<unsigned int> &indices);
+
+// Run the stages of optimization on V and F, filling the cache statistics
+// before and after
+void optimizeMesh(Eigen::MatrixXf &V, std::vector<unsigned int> &F, MeshOptimization optimization,
+                  CacheStats &before, CacheStats &after);
+
+#endif
@@ -0,0 +1,230 @@
+#include "MeshRegistry.h"
+
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+// Fraction of the threshold a coarser level has to reach before it is used
+const float levelHysteresis = 0.75f;
+
+bool GpuMesh::selectLevel(const Eigen::Matrix4f &transform, int width, int height, float threshold)
+{
+  if (levels.size() < 2)
+    return false;
+
+  // Pixels covered by one unit of the mesh, from the longest axis on screen
+  Eigen::Matrix<float, 2, 3> screen = transform.topLeftCorner<2, 3>();
+  screen.row(0) *= width * 0.5f;
+  screen.row(1) *= height * 0.5f;
+  float w = std::abs(transform(3, 3));
+  float pixels = screen.colwise().norm().maxCoeff() / (w > 0 ? w : 1);
+
+  unsigned int previous = level;
+  while (level + 1 < levels.size() && levels[level + 1].error * pixels <= levelHysteresis * threshold)
+    ++level;
+  while (level > 0 && levels[level].error * pixels > threshold)
+    --level;
+  return level != previous;
+}
+
+void GpuMesh::draw()
+{
+  VAO.bind();
+  detachInstances();
+  if (levels.empty())
+    EBO.draw();
+  else
+    EBO.draw(levels[level].first, levels[level].count);
+}
+
+namespace
+{
+
+bool firstBefore(const Meshlet &m, uint32_t first)
+{
+  return m.first < first;
+}
+
+}
+
+void GpuMesh::draw(const Eigen::Matrix4f &transform, bool backfaces, CullStats &stats)
+{
+  if (meshlets.empty())
+  {
+    draw();
+    return;
+  }
+
+  // Meshlets of the current level
+  const Meshlet *begin = meshlets.data(), *end = meshlets.data() + meshlets.size();
+  if (!levels.empty())
+  {
+    begin = std::lower_bound(begin, end, levels[level].first, firstBefore);
+    end = std::lower_bound(begin, end, levels[level].first + levels[level].count, firstBefore);
+  }
+
+  ranges.clear();
+  cullMeshlets(begin, end - begin, transform, backfaces, ranges, stats);
+
+  const size_t size = EBO.type == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(GLuint);
+  counts.clear();
+  offsets.clear();
+  for (size_t i = 0; i < ranges.size(); i += 2)
+  {
+    offsets.push_back((const GLvoid*)(ranges[i] * size));
+    counts.push_back(ranges[i + 1]);
+  }
+
+  VAO.bind();
+  detachInstances();
+  if (!counts.empty())
+    glMultiDrawElements(GL_TRIANGLES, counts.data(), EBO.type, offsets.data(), (GLsizei) counts.size());
+}
+
+MeshRegistry::MeshRegistry(size_t budget) : budget_(budget), used_(0)
+{
+}
+
+MeshRegistry::~MeshRegistry()
+{
+  clear();
+}
+
+GpuMesh* MeshRegistry::find(const std::string &key)
+{
+  std::unordered_map<std::string, std::list<GpuMesh>::iterator>::iterator it = index.find(key);
+  if (it == index.end())
+    return 0;
+  meshes.splice(meshes.begin(), meshes, it->second);
+  return &*it->second;
+}
+
+void GpuMesh::drawInstanced(InstanceBuffer &instances, GLint location)
+{
+  VAO.bind();
+  if (attached != instances.id || attachedLocation != location)
+  {
+    detachInstances();
+    instances.attach(location);
+    attached = instances.id;
+    attachedLocation = location;
+  }
+  if (levels.empty())
+    EBO.drawInstanced(0, EBO.count, (GLsizei) instances.size());
+  else
+    EBO.drawInstanced(levels[level].first, levels[level].count, (GLsizei) instances.size());
+}
+
+void GpuMesh::detachInstances()
+{
+  if (!attached)
+    return;
+  for (int i = 0; i < 4; ++i)
+    glDisableVertexAttribArray(attachedLocation + i);
+  attached = 0;
+}
+
+GpuMesh* MeshRegistry::add(const std::string &key, const PackedVertices &vertices,
+                           const GLuint *indices, GLsizei count,
+                           const std::vector<MeshLevel> &levels,
+                           const std::vector<Meshlet> &meshlets)
+{
+  remove(key);
+
+  size_t bytes = vertices.size + IndexBufferObject::indexSize(vertices.count) * count;
+  evict(bytes);
+  if (used_ + bytes > budget_)
+    std::cerr << "GPU memory budget exceeded while adding mesh " << key << std::endl;
+
+  meshes.push_front(GpuMesh());
+  GpuMesh &mesh = meshes.front();
+  index[key] = meshes.begin();
+  mesh.key = key;
+  mesh.format = vertices.format;
+  mesh.dequantize = vertices.dequantize;
+  mesh.vertices = vertices.count;
+  mesh.levels = levels;
+  mesh.meshlets = meshlets;
+  mesh.bytes = bytes;
+  used_ += bytes;
+
+  mesh.VAO.init();
+  mesh.VAO.bind();
+  mesh.VBO.init();
+  mesh.VBO.update(vertices.data, vertices.size);
+  mesh.EBO.init();
+  mesh.EBO.update(indices, count, vertices.count);
+  if (setupAttributes)
+    setupAttributes(vertices.format);
+  check_gl_error();
+
+  return &mesh;
+}
+
+void MeshRegistry::remove(const std::string &key)
+{
+  std::unordered_map<std::string, std::list<GpuMesh>::iterator>::iterator it = index.find(key);
+  if (it != index.end())
+    release(it->second);
+}
+
+void MeshRegistry::clear()
+{
+  while (!meshes.empty())
+    release(meshes.begin());
+}
+
+void MeshRegistry::setBudget(size_t bytes)
+{
+  budget_ = bytes;
+  evict(0);
+}
+
+void MeshRegistry::evict(size_t extra)
+{
+  while (meshes.size() > 1 && used_ + extra > budget_)
+    release(--meshes.end());
+}
+
+void MeshRegistry::release(std::list<GpuMesh>::iterator it)
+{
+  it->VAO.free();
+  it->VBO.free();
+  it->EBO.free();
+  used_ -= it->bytes;
+  index.erase(it->key);
+  meshes.erase(it);
+}
+
+void setupVertexAttributes(const Program &program, VertexFormat format)
+{
+  GLint posAttrib = program.attrib("position");
+  GLint colAttrib = program.attrib("color");
+  GLsizei stride = vertexSize(format);
+
+  glEnableVertexAttribArray(posAttrib);
+  if (vertexIsQuantized(format))
+    glVertexAttribPointer(posAttrib, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, 0);
+  else
+    glVertexAttribPointer(posAttrib, 3, GL_FLOAT, GL_FALSE, stride, 0);
+
+  check_gl_error();
+
+  // Formats without colors leave the attribute disabled, the shader
+  // computes the color from the position instead
+  if (colAttrib < 0)
+    return;
+  if (!vertexHasColor(format))
+  {
+    glDisableVertexAttribArray(colAttrib);
+  }
+  else
+  {
+    glEnableVertexAttribArray(colAttrib);
+    if (vertexIsQuantized(format))
+      glVertexAttribPointer(colAttrib, 3, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)(4 * sizeof(unsigned short)));
+    else
+      glVertexAttribPointer(colAttrib, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
+  }
+  check_gl_error();
+}
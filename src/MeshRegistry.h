@@ -0,0 +1,139 @@
+#ifndef MESHREGISTRY_H
+#define MESHREGISTRY_H
+
+#include "Helpers.h"
+#include "VertexFormat.h"
+#include "Mesh.h"
+#include "Meshlet.h"
+#include "InstanceBuffer.h"
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <functional>
+
+// A mesh resident on the GPU with its own vertex array, vertex buffer and
+// element buffer. The element buffer knows its index count and type.
+class GpuMesh
+{
+public:
+  std::string key;
+  VertexArrayObject VAO;
+  VertexBufferObject VBO;
+  IndexBufferObject EBO;
+
+  // Layout of the vertex buffer and the transform decoding its positions,
+  // to be applied before the model matrix
+  VertexFormat format;
+  Eigen::Matrix<float, 4, 4, Eigen::DontAlign> dequantize;
+  GLuint vertices;
+
+  // GPU memory held by the buffers
+  size_t bytes;
+
+  // Index ranges of the levels of detail, empty if the element buffer only
+  // holds the full mesh, and the level drawn
+  std::vector<MeshLevel> levels;
+  unsigned int level;
+
+  // Culling clusters of all levels sorted by first index, may be empty
+  std::vector<Meshlet> meshlets;
+
+  GpuMesh() : format(VERTEX_FLOAT), vertices(0), bytes(0), level(0), attached(0), attachedLocation(-1) {}
+
+  // Pick the coarsest level whose error stays within threshold pixels on a
+  // width x height viewport under transform (projection times model). A
+  // level is only left for a coarser one once that one is well within the
+  // threshold, so a mesh resting near a boundary does not flicker. Returns
+  // true if the level changed.
+  bool selectLevel(const Eigen::Matrix4f &transform, int width, int height, float threshold);
+
+  // Bind the VAO and draw the triangles of the current level
+  void draw();
+
+  // Draw the meshlets of the current level that survive culling against
+  // transform (projection times model) with one multi-draw call, adding to
+  // stats. Meshlets facing away are only skipped with backfaces, see
+  // cullMeshlets. Meshes without meshlets are drawn whole.
+  void draw(const Eigen::Matrix4f &transform, bool backfaces, CullStats &stats);
+
+  // Draw the current level once per instance of instances, whose matrices
+  // are read by the attributes starting at location
+  void drawInstanced(InstanceBuffer &instances, GLint location);
+
+private:
+  // Disable the instance attributes left on the VAO by drawInstanced
+  void detachInstances();
+
+  // Instance buffer whose attributes are enabled on the VAO, 0 if none
+  GLuint attached;
+  GLint attachedLocation;
+
+  // Per frame draw lists, kept to avoid allocations
+  std::vector<uint32_t> ranges;
+  std::vector<GLsizei> counts;
+  std::vector<const GLvoid*> offsets;
+};
+
+// GPU meshes keyed by source path. Switching to a resident mesh is a
+// lookup; when an upload would exceed the memory budget the least recently
+// used meshes are released first.
+class MeshRegistry
+{
+public:
+  // Called with a freshly created VAO and VBO bound to set up the vertex
+  // attributes of a new mesh in the given format
+  std::function<void(VertexFormat)> setupAttributes;
+
+  explicit MeshRegistry(size_t budget = 256 << 20);
+
+  // Release all meshes
+  ~MeshRegistry();
+
+  // Resident mesh for key marked as most recently used, 0 if not resident
+  GpuMesh* find(const std::string &key);
+
+  // Upload a mesh under key, replacing any previous one, and mark it as most
+  // recently used. Other meshes are evicted as needed to stay in budget.
+  // levels are the ranges of indices holding each level of detail and
+  // meshlets the culling clusters covering them.
+  GpuMesh* add(const std::string &key, const PackedVertices &vertices,
+               const GLuint *indices, GLsizei count,
+               const std::vector<MeshLevel> &levels = std::vector<MeshLevel>(),
+               const std::vector<Meshlet> &meshlets = std::vector<Meshlet>());
+
+  // Release the mesh stored under key
+  void remove(const std::string &key);
+
+  // Release all meshes
+  void clear();
+
+  // Change the budget in bytes, evicting meshes if it shrinks
+  void setBudget(size_t bytes);
+
+  size_t budget() const { return budget_; }
+  size_t used() const { return used_; }
+  size_t size() const { return meshes.size(); }
+
+private:
+  MeshRegistry(const MeshRegistry &);
+  MeshRegistry &operator=(const MeshRegistry &);
+
+  // Evict from the back until extra more bytes fit, always keeping the most
+  // recently used mesh which is the one on screen
+  void evict(size_t extra);
+
+  void release(std::list<GpuMesh>::iterator it);
+
+  // Most recently used first
+  std::list<GpuMesh> meshes;
+  std::unordered_map<std::string, std::list<GpuMesh>::iterator> index;
+  size_t budget_;
+  size_t used_;
+};
+
+// Enable the position and color attributes of program for vertices in
+// format, reading from the bound VBO
+void setupVertexAttributes(const Program &program, VertexFormat format);
+
+#endif
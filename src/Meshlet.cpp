@@ -0,0 +1,336 @@
+#include "Meshlet.h"
+
+#include <algorithm>
+#include <cmath>
+#include <Eigen/Geometry>
+#include <Eigen/LU>
+
+namespace
+{
+
+// Cones wider than this (dot of the widest normal with the axis) are not
+// worth testing
+const float minConeDot = 0.1f;
+
+void computeBounds(const Eigen::MatrixXf &V, const unsigned int *indices, size_t count, Meshlet &m)
+{
+  Eigen::Vector3f lo = V.col(indices[0]).head<3>(), hi = lo;
+  for (size_t i = 1; i < count; ++i)
+  {
+    lo = lo.cwiseMin(V.col(indices[i]).head<3>());
+    hi = hi.cwiseMax(V.col(indices[i]).head<3>());
+  }
+  Eigen::Vector3f center = (lo + hi) / 2;
+  float radius = 0;
+  for (size_t i = 0; i < count; ++i)
+    radius = std::max(radius, (V.col(indices[i]).head<3>() - center).norm());
+
+  std::vector<Eigen::Vector3f> normals;
+  normals.reserve(count / 3);
+  Eigen::Vector3f sum = Eigen::Vector3f::Zero();
+  for (size_t t = 0; t + 2 < count; t += 3)
+  {
+    Eigen::Vector3f a = V.col(indices[t]).head<3>();
+    Eigen::Vector3f n = (V.col(indices[t + 1]).head<3>() - a).cross(V.col(indices[t + 2]).head<3>() - a);
+    if (n.norm() == 0)
+      continue;
+    n.normalize();
+    normals.push_back(n);
+    sum += n;
+  }
+
+  Eigen::Vector3f axis = Eigen::Vector3f::Zero();
+  float cutoff = 1;
+  if (sum.norm() > 0)
+  {
+    axis = sum.normalized();
+    float minDot = 1;
+    for (size_t i = 0; i < normals.size(); ++i)
+      minDot = std::min(minDot, normals[i].dot(axis));
+    if (minDot > minConeDot)
+      cutoff = std::sqrt(1 - minDot * minDot);
+  }
+
+  for (int k = 0; k < 3; ++k)
+  {
+    m.center[k] = center[k];
+    m.axis[k] = axis[k];
+  }
+  m.radius = radius;
+  m.cutoff = cutoff;
+}
+
+// Greedily grow meshlets over the triangles sharing vertices with them,
+// preferring those that add the fewest new vertices and then those best
+// aligned with the meshlet normal, which keeps the normal cones narrow
+void buildLevel(const Eigen::MatrixXf &V, unsigned int *indices, size_t count, uint32_t first,
+                std::vector<Meshlet> &meshlets)
+{
+  const size_t triangles = count / 3;
+  const size_t vertices = V.cols();
+
+  std::vector<unsigned int> offsets(vertices + 1, 0);
+  for (size_t i = 0; i < count; ++i)
+    ++offsets[indices[i] + 1];
+  for (size_t v = 0; v < vertices; ++v)
+    offsets[v + 1] += offsets[v];
+  std::vector<unsigned int> adjacency(count);
+  std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+  for (size_t t = 0; t < triangles; ++t)
+    for (int k = 0; k < 3; ++k)
+      adjacency[fill[indices[t * 3 + k]]++] = (unsigned int) t;
+
+  std::vector<Eigen::Vector3f> normals(triangles);
+  for (size_t t = 0; t < triangles; ++t)
+  {
+    Eigen::Vector3f a = V.col(indices[t * 3]).head<3>();
+    Eigen::Vector3f n = (V.col(indices[t * 3 + 1]).head<3>() - a).cross(V.col(indices[t * 3 + 2]).head<3>() - a);
+    normals[t] = n.norm() > 0 ? n.normalized() : n;
+  }
+
+  // Vertex v is in the current meshlet if mark[v] equals its number
+  std::vector<size_t> mark(vertices, 0);
+  std::vector<bool> used(triangles, false);
+  std::vector<unsigned int> order;
+  order.reserve(count);
+  std::vector<unsigned int> candidates;
+  size_t cursor = 0;
+  size_t number = 0;
+
+  while (cursor < triangles)
+  {
+    if (used[cursor])
+    {
+      ++cursor;
+      continue;
+    }
+
+    ++number;
+    size_t begin = order.size();
+    size_t meshletVerts = 0;
+    Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+    candidates.clear();
+    size_t next = cursor;
+
+    for (;;)
+    {
+      used[next] = true;
+      normal += normals[next];
+      for (int k = 0; k < 3; ++k)
+      {
+        unsigned int v = indices[next * 3 + k];
+        order.push_back(v);
+        if (mark[v] == number)
+          continue;
+        mark[v] = number;
+        ++meshletVerts;
+        for (unsigned int a = offsets[v]; a < offsets[v + 1]; ++a)
+          if (!used[adjacency[a]])
+            candidates.push_back(adjacency[a]);
+      }
+      if ((order.size() - begin) / 3 >= meshletTriangles)
+        break;
+
+      // Pick the best remaining candidate, dropping used ones on the way
+      size_t best = triangles;
+      int bestNew = 4;
+      float bestDot = -2;
+      size_t kept = 0;
+      for (size_t c = 0; c < candidates.size(); ++c)
+      {
+        unsigned int t = candidates[c];
+        if (used[t])
+          continue;
+        candidates[kept++] = t;
+        int added = 0;
+        for (int k = 0; k < 3; ++k)
+          added += mark[indices[t * 3 + k]] != number;
+        if (meshletVerts + added > meshletVertices)
+          continue;
+        float dot = normals[t].dot(normal);
+        if (added < bestNew || (added == bestNew && dot > bestDot))
+        {
+          best = t;
+          bestNew = added;
+          bestDot = dot;
+        }
+      }
+      candidates.resize(kept);
+      if (best == triangles)
+        break;
+      next = best;
+    }
+
+    Meshlet m;
+    m.first = first + (uint32_t) begin;
+    m.count = (uint32_t) (order.size() - begin);
+    computeBounds(V, &order[begin], m.count, m);
+    meshlets.push_back(m);
+  }
+
+  std::copy(order.begin(), order.end(), indices);
+}
+
+}
+
+void buildMeshlets(const Eigen::MatrixXf &V, std::vector<unsigned int> &F,
+                   const std::vector<MeshLevel> &levels, std::vector<Meshlet> &meshlets)
+{
+  meshlets.clear();
+  if (levels.empty())
+  {
+    if (!F.empty())
+      buildLevel(V, F.data(), F.size(), 0, meshlets);
+    return;
+  }
+  for (size_t i = 0; i < levels.size(); ++i)
+    if (levels[i].count > 0)
+      buildLevel(V, F.data() + levels[i].first, levels[i].count, levels[i].first, meshlets);
+}
+
+void optimizeMeshlets(const Eigen::MatrixXf &V, std::vector<unsigned int> &F,
+                      const std::vector<MeshLevel> &levels, std::vector<Meshlet> &meshlets,
+                      MeshOptimization optimization)
+{
+  if (optimization == OPTIMIZE_NONE)
+    return;
+
+  // Meshlets are optimized on local vertex numbers, so the cost of each
+  // does not depend on the size of the mesh
+  const unsigned int unused = ~0u;
+  std::vector<unsigned int> remap(V.cols(), unused);
+  std::vector<unsigned int> local, vertices;
+  for (size_t i = 0; i < meshlets.size(); ++i)
+  {
+    const Meshlet &m = meshlets[i];
+    local.assign(F.begin() + m.first, F.begin() + m.first + m.count);
+    vertices.clear();
+    for (size_t k = 0; k < local.size(); ++k)
+    {
+      unsigned int &r = remap[local[k]];
+      if (r == unused)
+      {
+        r = (unsigned int) vertices.size();
+        vertices.push_back(local[k]);
+      }
+      local[k] = r;
+    }
+    optimizeVertexCache(local, vertices.size());
+    for (size_t k = 0; k < local.size(); ++k)
+      F[m.first + k] = vertices[local[k]];
+    for (size_t k = 0; k < vertices.size(); ++k)
+      remap[vertices[k]] = unused;
+  }
+  if (optimization != OPTIMIZE_OVERDRAW)
+    return;
+
+  // Sort the meshlets of each level, which are contiguous, around its center
+  size_t levelCount = levels.empty() ? 1 : levels.size();
+  size_t next = 0;
+  std::vector<std::pair<float, size_t> > order;
+  std::vector<Meshlet> sorted;
+  std::vector<unsigned int> output;
+  for (size_t l = 0; l < levelCount; ++l)
+  {
+    uint32_t begin = levels.empty() ? 0 : levels[l].first;
+    uint32_t count = levels.empty() ? (uint32_t) F.size() : levels[l].count;
+    size_t end = next;
+    while (end < meshlets.size() && meshlets[end].first < begin + count)
+      ++end;
+    if (end - next < 2)
+    {
+      next = end;
+      continue;
+    }
+
+    Eigen::Vector3f center = triangleCentroid(&F[begin], count, V);
+    order.clear();
+    for (size_t i = next; i < end; ++i)
+      order.push_back(std::make_pair(overdrawKey(&F[meshlets[i].first], meshlets[i].count, V, center), i));
+    std::stable_sort(order.begin(), order.end());
+
+    sorted.clear();
+    output.clear();
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+      Meshlet m = meshlets[order[i].second];
+      output.insert(output.end(), F.begin() + m.first, F.begin() + m.first + m.count);
+      m.first = begin + (uint32_t) (output.size() - m.count);
+      sorted.push_back(m);
+    }
+    std::copy(output.begin(), output.end(), F.begin() + begin);
+    std::copy(sorted.begin(), sorted.end(), meshlets.begin() + next);
+    next = end;
+  }
+}
+
+void cullMeshlets(const Meshlet *meshlets, size_t n, const Eigen::Matrix4f &transform, bool backfaces,
+                  std::vector<uint32_t> &ranges, CullStats &stats)
+{
+  // Frustum planes in mesh space (Gribb and Hartmann), normalized so that
+  // they give distances
+  Eigen::Vector4f planes[6];
+  for (int i = 0; i < 3; ++i)
+  {
+    planes[i * 2] = transform.row(3) + transform.row(i);
+    planes[i * 2 + 1] = transform.row(3) - transform.row(i);
+  }
+  for (int i = 0; i < 6; ++i)
+  {
+    float length = planes[i].head<3>().norm();
+    if (length > 0)
+      planes[i] /= length;
+  }
+
+  // The viewer is where clip space z decreases, which is nearer in the
+  // depth test: a point for perspective views, a direction for orthographic
+  // ones
+  Eigen::Vector4f eye = transform.inverse() * Eigen::Vector4f(0, 0, -1, 0);
+  const bool orthographic = std::abs(eye[3]) < 1e-6f * eye.head<3>().norm();
+  Eigen::Vector3f viewer = orthographic ? Eigen::Vector3f(eye.head<3>().normalized())
+                                        : Eigen::Vector3f(eye.head<3>() / eye[3]);
+
+  for (size_t i = 0; i < n; ++i)
+  {
+    const Meshlet &m = meshlets[i];
+    Eigen::Vector3f center(m.center[0], m.center[1], m.center[2]);
+    Eigen::Vector3f axis(m.axis[0], m.axis[1], m.axis[2]);
+    ++stats.meshlets;
+    stats.triangles += m.count / 3;
+
+    bool outside = false;
+    for (int p = 0; p < 6 && !outside; ++p)
+      outside = planes[p].head<3>().dot(center) + planes[p][3] < -m.radius;
+    if (outside)
+    {
+      ++stats.frustumCulled;
+      continue;
+    }
+
+    if (backfaces && m.cutoff < 1)
+    {
+      bool away;
+      if (orthographic)
+        away = axis.dot(viewer) < -m.cutoff;
+      else
+      {
+        Eigen::Vector3f view = center - viewer;
+        away = view.dot(axis) >= m.cutoff * view.norm() + m.radius;
+      }
+      if (away)
+      {
+        ++stats.backfaceCulled;
+        continue;
+      }
+    }
+
+    stats.trianglesDrawn += m.count / 3;
+    if (!ranges.empty() && ranges[ranges.size() - 2] + ranges.back() == m.first)
+      ranges.back() += m.count;
+    else
+    {
+      ranges.push_back(m.first);
+      ranges.push_back(m.count);
+    }
+  }
+}
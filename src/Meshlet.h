@@ -0,0 +1,74 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include "Mesh.h"
+#include "MeshOptimizer.h"
+
+#include <vector>
+
+// Limits of a meshlet, small enough for tight bounds and large enough to
+// keep the number of clusters per mesh low
+const unsigned int meshletVertices = 64;
+const unsigned int meshletTriangles = 124;
+
+// A cluster of neighbouring triangles stored as a contiguous range of the
+// index buffer, with the bounds used to cull it. Positions are in the space
+// of the mesh vertices, before the model matrix.
+struct Meshlet
+{
+  // Range of indices
+  uint32_t first;
+  uint32_t count;
+
+  // Bounding sphere
+  float center[3];
+  float radius;
+
+  // Normal cone: every triangle normal n satisfies dot(n, axis) >= cos(a)
+  // where cutoff = sin(a). A cutoff of 1 means the cone cannot be culled.
+  float axis[3];
+  float cutoff;
+};
+
+// Partition every level of detail of F into meshlets, reordering the
+// triangles within each level so that every meshlet is a contiguous range.
+// meshlets receives them sorted by first index. Without levels F is treated
+// as a single level.
+void buildMeshlets(const Eigen::MatrixXf &V, std::vector<unsigned int> &F,
+                   const std::vector<MeshLevel> &levels, std::vector<Meshlet> &meshlets);
+
+// Restore the reordering of optimizeMesh, which buildMeshlets replaces by
+// its growth order: the triangles of every meshlet are reordered for the
+// vertex cache and, with OPTIMIZE_OVERDRAW, the meshlets of every level are
+// sorted like the clusters of optimizeOverdraw. Meshlets keep their bounds
+// and stay sorted by first index.
+void optimizeMeshlets(const Eigen::MatrixXf &V, std::vector<unsigned int> &F,
+                      const std::vector<MeshLevel> &levels, std::vector<Meshlet> &meshlets,
+                      MeshOptimization optimization);
+
+// Meshlet culling counts, accumulated over any number of frames
+class CullStats
+{
+public:
+  size_t meshlets;
+  size_t frustumCulled;
+  size_t backfaceCulled;
+  size_t triangles;
+  size_t trianglesDrawn;
+
+  CullStats() { reset(); }
+
+  void reset() { meshlets = frustumCulled = backfaceCulled = triangles = trianglesDrawn = 0; }
+};
+
+// Test n meshlets against the view of transform (projection times model)
+// and append the index ranges that may be visible to ranges as (first,
+// count) pairs, merging neighbours. Meshlets outside the frustum are
+// skipped, and with backfaces those whose triangles all face away from the
+// viewer, which is only correct when GL culls back faces of filled
+// polygons. The viewer is recovered from transform, so the test also holds
+// for orthographic views.
+void cullMeshlets(const Meshlet *meshlets, size_t n, const Eigen::Matrix4f &transform, bool backfaces,
+                  std::vector<uint32_t> &ranges, CullStats &stats);
+
+#endif
@@ -0,0 +1,420 @@
+#include "RayTracer.h"
+#include "Trace.h"
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+namespace
+{
+  // Triangles per leaf when splitting stops paying off, and the buckets
+  // the surface area heuristic is evaluated at
+  const size_t leafSize = 4;
+  const int buckets = 12;
+
+  // Nodes below this depth are made leaves, so that traversal never holds
+  // more than maxDepth subtrees on its stack
+  const int maxDepth = 64;
+
+  float surfaceArea(const Eigen::Vector3f &lower, const Eigen::Vector3f &upper)
+  {
+    Eigen::Vector3f e = (upper - lower).cwiseMax(0);
+    return 2 * (e[0] * e[1] + e[1] * e[2] + e[2] * e[0]);
+  }
+
+  // Integer hash of a pixel and sample, so that random directions do not
+  // depend on which thread traces the pixel
+  uint32_t hash(uint32_t x)
+  {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+  }
+
+  float random(uint32_t &state)
+  {
+    state = hash(state + 0x9e3779b9u);
+    return (state >> 8) * (1.0f / 16777216.0f);
+  }
+
+  // Direction around normal n with a cosine weighted distribution
+  Eigen::Vector3f cosineDirection(const Eigen::Vector3f &n, float r1, float r2)
+  {
+    // Orthonormal basis without branches on the normal (Duff et al.)
+    float sign = std::copysign(1.0f, n[2]);
+    float a = -1 / (sign + n[2]), b = n[0] * n[1] * a;
+    Eigen::Vector3f t(1 + sign * n[0] * n[0] * a, sign * b, -sign * n[0]);
+    Eigen::Vector3f s(b, sign + n[1] * n[1] * a, -n[1]);
+    float phi = 2 * 3.14159265f * r1, r = std::sqrt(r2);
+    return t * (r * std::cos(phi)) + s * (r * std::sin(phi)) + n * std::sqrt(std::max(0.0f, 1 - r2));
+  }
+}
+
+RayTracer::RayTracer(ThreadPool *pool)
+  : width(0), height(0), colorMode(0), shadows(false), lightDirection(Eigen::Vector3f(-1, 1, 1).normalized()),
+    shadowLevel(0.4f), aoSamples(0), aoRadius(0.5f), rays(0), buildSeconds(0), renderSeconds(0), pool(pool), mesh(0),
+    epsilon(1e-5f)
+{
+}
+
+void RayTracer::build(const SoftwareMesh &mesh)
+{
+  TRACE_SCOPE("build BVH");
+  uint64_t start = traceNow();
+  this->mesh = &mesh;
+  size_t count = mesh.indices.size() / 3;
+  std::vector<Eigen::Vector3f> lower(count), upper(count), centroids(count);
+  Eigen::Vector3f sceneLower = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+  Eigen::Vector3f sceneUpper = -sceneLower;
+  for (size_t i = 0; i < count; ++i)
+  {
+    const Eigen::Vector3f &a = mesh.positions[mesh.indices[3 * i]];
+    const Eigen::Vector3f &b = mesh.positions[mesh.indices[3 * i + 1]];
+    const Eigen::Vector3f &c = mesh.positions[mesh.indices[3 * i + 2]];
+    lower[i] = a.cwiseMin(b).cwiseMin(c);
+    upper[i] = a.cwiseMax(b).cwiseMax(c);
+    centroids[i] = (lower[i] + upper[i]) / 2;
+    sceneLower = sceneLower.cwiseMin(lower[i]);
+    sceneUpper = sceneUpper.cwiseMax(upper[i]);
+  }
+  epsilon = count > 0 ? 1e-4f * (sceneUpper - sceneLower).norm() : 1e-5f;
+
+  std::vector<unsigned int> order(count);
+  for (size_t i = 0; i < count; ++i)
+    order[i] = (unsigned int) i;
+  nodes.clear();
+  nodes.reserve(2 * count / leafSize + 1);
+  if (count > 0)
+    buildNode(order, 0, count, 0, lower, upper, centroids);
+
+  // Triangles in leaf order, so that a leaf reads consecutive memory
+  triangles.resize(count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    const unsigned int *index = &mesh.indices[3 * order[i]];
+    Triangle &t = triangles[i];
+    t.corner = mesh.positions[index[0]];
+    t.edge1 = mesh.positions[index[1]] - t.corner;
+    t.edge2 = mesh.positions[index[2]] - t.corner;
+    t.index = order[i];
+  }
+  buildSeconds += (traceNow() - start) * 1e-9;
+}
+
+unsigned int RayTracer::buildNode(std::vector<unsigned int> &order, size_t begin, size_t end, int depth,
+                                  const std::vector<Eigen::Vector3f> &lower, const std::vector<Eigen::Vector3f> &upper,
+                                  const std::vector<Eigen::Vector3f> &centroids)
+{
+  unsigned int id = (unsigned int) nodes.size();
+  nodes.push_back(Node());
+
+  Eigen::Vector3f boxLower = lower[order[begin]], boxUpper = upper[order[begin]];
+  Eigen::Vector3f centerLower = centroids[order[begin]], centerUpper = centerLower;
+  for (size_t i = begin + 1; i < end; ++i)
+  {
+    boxLower = boxLower.cwiseMin(lower[order[i]]);
+    boxUpper = boxUpper.cwiseMax(upper[order[i]]);
+    centerLower = centerLower.cwiseMin(centroids[order[i]]);
+    centerUpper = centerUpper.cwiseMax(centroids[order[i]]);
+  }
+  for (int k = 0; k < 3; ++k)
+  {
+    nodes[id].lower[k] = boxLower[k];
+    nodes[id].upper[k] = boxUpper[k];
+  }
+
+  size_t count = end - begin;
+  int axis;
+  (centerUpper - centerLower).maxCoeff(&axis);
+  float extent = centerUpper[axis] - centerLower[axis];
+  size_t middle = begin;
+  if (count > leafSize && extent > 0 && depth + 1 < maxDepth)
+  {
+    // Bucket the centroids along the widest axis and take the cheapest
+    // split between buckets
+    int bucketCount[buckets] = { 0 };
+    Eigen::Vector3f bucketLower[buckets], bucketUpper[buckets];
+    for (int b = 0; b < buckets; ++b)
+    {
+      bucketLower[b] = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+      bucketUpper[b] = -bucketLower[b];
+    }
+    float scale = buckets / extent;
+    for (size_t i = begin; i < end; ++i)
+    {
+      int b = std::min(buckets - 1, int((centroids[order[i]][axis] - centerLower[axis]) * scale));
+      ++bucketCount[b];
+      bucketLower[b] = bucketLower[b].cwiseMin(lower[order[i]]);
+      bucketUpper[b] = bucketUpper[b].cwiseMax(upper[order[i]]);
+    }
+
+    float rightArea[buckets];
+    int rightCount[buckets];
+    Eigen::Vector3f l = bucketLower[buckets - 1], u = bucketUpper[buckets - 1];
+    int n = 0;
+    for (int b = buckets - 1; b > 0; --b)
+    {
+      l = l.cwiseMin(bucketLower[b]);
+      u = u.cwiseMax(bucketUpper[b]);
+      n += bucketCount[b];
+      rightArea[b] = surfaceArea(l, u);
+      rightCount[b] = n;
+    }
+
+    float bestCost = std::numeric_limits<float>::max();
+    int bestSplit = -1;
+    l = bucketLower[0];
+    u = bucketUpper[0];
+    n = 0;
+    for (int b = 1; b < buckets; ++b)
+    {
+      l = l.cwiseMin(bucketLower[b - 1]);
+      u = u.cwiseMax(bucketUpper[b - 1]);
+      n += bucketCount[b - 1];
+      if (n == 0 || rightCount[b] == 0)
+        continue;
+      float cost = n * surfaceArea(l, u) + rightCount[b] * rightArea[b];
+      if (cost < bestCost)
+      {
+        bestCost = cost;
+        bestSplit = b;
+      }
+    }
+
+    // Splitting costs a box test, a leaf tests every triangle
+    float leafCost = count * surfaceArea(boxLower, boxUpper);
+    if (bestSplit > 0 && bestCost + surfaceArea(boxLower, boxUpper) < leafCost)
+      middle = std::partition(order.begin() + begin, order.begin() + end, [&](unsigned int t) {
+        return std::min(buckets - 1, int((centroids[t][axis] - centerLower[axis]) * scale)) < bestSplit;
+      }) - order.begin();
+  }
+
+  if (middle == begin || middle == end)
+  {
+    nodes[id].first = (unsigned int) begin;
+    nodes[id].count = (unsigned int) count;
+    return id;
+  }
+  buildNode(order, begin, middle, depth + 1, lower, upper, centroids);
+  unsigned int right = buildNode(order, middle, end, depth + 1, lower, upper, centroids);
+  nodes[id].first = right;
+  nodes[id].count = 0;
+  return id;
+}
+
+bool RayTracer::intersect(const Ray &ray, float tMin, float tMax, Hit &hit, bool any) const
+{
+  if (nodes.empty())
+    return false;
+  const Eigen::Vector3f inverse = ray.direction.cwiseInverse();
+  bool found = false;
+  unsigned int stack[maxDepth];
+  int top = 0;
+  unsigned int node = 0;
+  for (;;)
+  {
+    const Node &n = nodes[node];
+
+    // Slab test against the box
+    float t0 = tMin, t1 = tMax;
+    for (int k = 0; k < 3; ++k)
+    {
+      float tNear = (n.lower[k] - ray.origin[k]) * inverse[k];
+      float tFar = (n.upper[k] - ray.origin[k]) * inverse[k];
+      if (tNear > tFar)
+        std::swap(tNear, tFar);
+      t0 = tNear > t0 ? tNear : t0;
+      t1 = tFar < t1 ? tFar : t1;
+    }
+
+    if (t0 <= t1)
+    {
+      if (n.count == 0)
+      {
+        // Visit the child on the side the ray comes from first
+        unsigned int first = node + 1, second = n.first;
+        int axis = 0;
+        float widest = n.upper[0] - n.lower[0];
+        for (int k = 1; k < 3; ++k)
+          if (n.upper[k] - n.lower[k] > widest)
+          {
+            widest = n.upper[k] - n.lower[k];
+            axis = k;
+          }
+        if (ray.direction[axis] < 0)
+          std::swap(first, second);
+        assert(top < maxDepth);
+        stack[top++] = second;
+        node = first;
+        continue;
+      }
+
+      for (unsigned int i = n.first; i < n.first + n.count; ++i)
+      {
+        const Triangle &t = triangles[i];
+        Eigen::Vector3f p = ray.direction.cross(t.edge2);
+        float det = t.edge1.dot(p);
+        if (det == 0)
+          continue;
+        float invDet = 1 / det;
+        Eigen::Vector3f s = ray.origin - t.corner;
+        float u = s.dot(p) * invDet;
+        if (u < 0 || u > 1)
+          continue;
+        Eigen::Vector3f q = s.cross(t.edge1);
+        float v = ray.direction.dot(q) * invDet;
+        if (v < 0 || u + v > 1)
+          continue;
+        float d = t.edge2.dot(q) * invDet;
+        if (d <= tMin || d >= tMax)
+          continue;
+        hit.t = d;
+        hit.u = u;
+        hit.v = v;
+        hit.triangle = i;
+        found = true;
+        if (any)
+          return true;
+        tMax = d;
+      }
+    }
+    if (top == 0)
+      return found;
+    node = stack[--top];
+  }
+}
+
+void RayTracer::resize(int width, int height)
+{
+  this->width = width;
+  this->height = height;
+  color.resize(size_t(width) * height * 3);
+}
+
+void RayTracer::render(const Eigen::Matrix4f &projection, const Eigen::Matrix4f &model)
+{
+  TRACE_SCOPE("ray trace");
+  if (!mesh || width <= 0 || height <= 0)
+    return;
+  uint64_t start = traceNow();
+
+  vertexColors.resize(mesh->positions.size());
+  for (size_t i = 0; i < vertexColors.size(); ++i)
+    vertexColors[i] = shaderVertexColor(colorMode, mesh->positions[i], mesh->colors[i]);
+
+  // Pixels map back to model space through the inverse of both matrices
+  Eigen::Matrix4f unproject = (projection * model).inverse();
+  Eigen::Matrix3f toModel = model.topLeftCorner<3, 3>().inverse();
+
+  int tilesX = (width + tileSize - 1) / tileSize, tilesY = (height + tileSize - 1) / tileSize;
+  tileRays.assign(size_t(tilesX) * tilesY, 0);
+  pool->parallelFor(tileRays.size(), [&](size_t tile) { renderTile(tile, unproject, toModel); });
+  for (size_t i = 0; i < tileRays.size(); ++i)
+    rays += tileRays[i];
+  renderSeconds += (traceNow() - start) * 1e-9;
+}
+
+void RayTracer::renderTile(size_t tile, const Eigen::Matrix4f &unproject, const Eigen::Matrix3f &toModel)
+{
+  int tilesX = (width + tileSize - 1) / tileSize;
+  int x0 = int(tile % tilesX) * tileSize, y0 = int(tile / tilesX) * tileSize;
+  int x1 = std::min(x0 + tileSize, width), y1 = std::min(y0 + tileSize, height);
+  size_t traced = 0;
+  for (int y = y0; y < y1; ++y)
+    for (int x = x0; x < x1; ++x)
+    {
+      // From the near to the far plane through the pixel center, rows
+      // from the top
+      float nx = 2 * (x + 0.5f) / width - 1, ny = 1 - 2 * (y + 0.5f) / height;
+      Eigen::Vector4f nearPoint = unproject * Eigen::Vector4f(nx, ny, -1, 1);
+      Eigen::Vector4f farPoint = unproject * Eigen::Vector4f(nx, ny, 1, 1);
+      Ray ray;
+      ray.origin = nearPoint.head<3>() / nearPoint[3];
+      ray.direction = farPoint.head<3>() / farPoint[3] - ray.origin;
+      float length = ray.direction.norm();
+      ray.direction /= length;
+
+      Hit hit;
+      ++traced;
+      unsigned char *out = &color[(size_t(y) * width + x) * 3];
+      if (!intersect(ray, 0, length, hit, false))
+      {
+        out[0] = out[1] = out[2] = 0;
+        continue;
+      }
+      const unsigned int *index = &mesh->indices[3 * triangles[hit.triangle].index];
+      Eigen::Vector3f c = (1 - hit.u - hit.v) * vertexColors[index[0]] + hit.u * vertexColors[index[1]] +
+                          hit.v * vertexColors[index[2]];
+      float light = shadows || aoSamples > 0 ? lighting(ray, hit, x, y, toModel, traced) : 1;
+      for (int k = 0; k < 3; ++k)
+      {
+        out[k] = shaderFragmentChannel(c[k]);
+        if (light < 1)
+          out[k] = (unsigned char) (out[k] * light + 0.5f);
+      }
+    }
+  tileRays[tile] = traced;
+}
+
+float RayTracer::lighting(const Ray &ray, const Hit &hit, int x, int y, const Eigen::Matrix3f &toModel,
+                          size_t &traced) const
+{
+  // Secondary rays leave from the side the primary ray came from. Their
+  // directions are unit length in the world, so their t is in world units.
+  const Triangle &t = triangles[hit.triangle];
+  Eigen::Vector3f normal = t.edge1.cross(t.edge2).normalized();
+  if (normal.dot(ray.direction) > 0)
+    normal = -normal;
+  Eigen::Vector3f worldNormal = (toModel.transpose() * normal).normalized();
+  Ray secondary;
+  secondary.origin = ray.origin + hit.t * ray.direction + epsilon * normal;
+  Hit blocker;
+  float factor = 1;
+
+  if (shadows)
+  {
+    Eigen::Vector3f light = lightDirection.normalized();
+    bool shadowed = worldNormal.dot(light) <= 0;
+    if (!shadowed)
+    {
+      secondary.direction = toModel * light;
+      ++traced;
+      shadowed = intersect(secondary, 0, std::numeric_limits<float>::max(), blocker, true);
+    }
+    if (shadowed)
+      factor *= shadowLevel;
+  }
+
+  if (aoSamples > 0)
+  {
+    uint32_t state = hash(uint32_t(y) * 65521u + uint32_t(x));
+    unsigned int open = 0;
+    for (unsigned int i = 0; i < aoSamples; ++i)
+    {
+      float r1 = random(state), r2 = random(state);
+      secondary.direction = toModel * cosineDirection(worldNormal, r1, r2);
+      ++traced;
+      if (!intersect(secondary, 0, aoRadius, blocker, true))
+        ++open;
+    }
+    factor *= float(open) / aoSamples;
+  }
+  return factor;
+}
+
+void RayTracer::read(std::vector<unsigned char> &rgb) const
+{
+  rgb = color;
+}
+
+void RayTracer::resetStats()
+{
+  rays = 0;
+  buildSeconds = renderSeconds = 0;
+}
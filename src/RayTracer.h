@@ -0,0 +1,139 @@
+#ifndef RAYTRACER_H
+#define RAYTRACER_H
+
+#include "SoftwareRasterizer.h"
+#include "ThreadPool.h"
+
+#include <vector>
+#include <Eigen/Core>
+
+// Renders a mesh on the CPU by casting a ray through every pixel center.
+// Primary rays are the pixels unprojected through (projection * model)^-1
+// between the near and far planes, so the nearest hit is what the GL depth
+// test keeps, shaded like the viewer's shaders: the interpolated vertex
+// color +0.2 ambient. Optionally that color is darkened where a
+// directional light is blocked, and by ambient occlusion.
+//
+// Triangles are kept in a bounding volume hierarchy built with the
+// surface area heuristic in model space. Rays are transformed into model
+// space instead of the triangles into the world, so only the affine
+// camera and model matrices have to be inverted per frame. The image is
+// traced in 16x16 pixel tiles on the pool. The random directions of a
+// pixel only depend on its position, so images do not depend on the
+// number of threads.
+class RayTracer
+{
+public:
+  static const int tileSize = 16;
+
+  int width;
+  int height;
+
+  // Color function of the vertex shader, see shaderVertexColor
+  int colorMode;
+
+  // Darken surfaces facing away from the light or blocked from it to
+  // shadowLevel of their color. The direction points toward the light in
+  // world space.
+  bool shadows;
+  Eigen::Vector3f lightDirection;
+  float shadowLevel;
+
+  // Rays per hit for ambient occlusion, 0 to disable, and how far in world
+  // units they look for occluders
+  unsigned int aoSamples;
+  float aoRadius;
+
+  // Rays cast and time spent building and tracing
+  size_t rays;
+  double buildSeconds;
+  double renderSeconds;
+
+  explicit RayTracer(ThreadPool *pool);
+
+  // Build the hierarchy over the triangles of mesh, which must stay alive
+  // while rendering
+  void build(const SoftwareMesh &mesh);
+
+  // Resize the image, its contents are undefined
+  void resize(int width, int height);
+
+  // Trace the mesh seen through projection, placed by model
+  void render(const Eigen::Matrix4f &projection, const Eigen::Matrix4f &model);
+
+  // The image as RGB rows from top to bottom
+  void read(std::vector<unsigned char> &rgb) const;
+
+  // Restart the ray count and times
+  void resetStats();
+
+private:
+  RayTracer(const RayTracer &);
+  RayTracer &operator=(const RayTracer &);
+
+  // Box of a subtree. Leaves hold count triangles from first, inner nodes
+  // have count 0, their left child next to them and the right one at first.
+  class Node
+  {
+  public:
+    float lower[3], upper[3];
+    unsigned int first;
+    unsigned int count;
+  };
+
+  // A triangle as a corner and two edges, for Moller-Trumbore tests
+  class Triangle
+  {
+  public:
+    Eigen::Vector3f corner, edge1, edge2;
+    unsigned int index;
+  };
+
+  class Ray
+  {
+  public:
+    Eigen::Vector3f origin;
+    Eigen::Vector3f direction;
+  };
+
+  class Hit
+  {
+  public:
+    float t, u, v;
+    unsigned int triangle;
+  };
+
+  // Build the subtree at depth over order[begin, end), returns its node
+  unsigned int buildNode(std::vector<unsigned int> &order, size_t begin, size_t end, int depth,
+                         const std::vector<Eigen::Vector3f> &lower, const std::vector<Eigen::Vector3f> &upper,
+                         const std::vector<Eigen::Vector3f> &centroids);
+
+  // Nearest hit within (tMin, tMax), or with any=true the first one found
+  bool intersect(const Ray &ray, float tMin, float tMax, Hit &hit, bool any) const;
+
+  // toModel is the inverse of the linear part of the model matrix, which
+  // carries directions from world to model space
+  void renderTile(size_t tile, const Eigen::Matrix4f &unproject, const Eigen::Matrix3f &toModel);
+
+  // Fraction of the shaded color left by shadows and ambient occlusion at
+  // a hit, counting the rays cast in traced
+  float lighting(const Ray &ray, const Hit &hit, int x, int y, const Eigen::Matrix3f &toModel, size_t &traced) const;
+
+  ThreadPool *pool;
+  const SoftwareMesh *mesh;
+  std::vector<Node> nodes;
+  std::vector<Triangle> triangles;
+
+  // Vertex colors for the current color mode
+  std::vector<Eigen::Vector3f> vertexColors;
+
+  // Offset of secondary rays from the surface, in model units
+  float epsilon;
+
+  std::vector<unsigned char> color;
+
+  // Rays cast by each tile of the current frame
+  std::vector<size_t> tileRays;
+};
+
+#endif
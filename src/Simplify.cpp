@@ -0,0 +1,309 @@
+#include "Simplify.h"
+
+#include <algorithm>
+#include <queue>
+#include <cmath>
+#include <Eigen/Geometry>
+
+namespace
+{
+
+// Symmetric 4x4 error quadric, the upper triangle stored row by row
+class Quadric
+{
+public:
+  double q[10];
+
+  Quadric() { std::fill(q, q + 10, 0.0); }
+
+  // Add the squared distance to the plane n.x + d = 0
+  void addPlane(const Eigen::Vector3d &n, double d, double weight)
+  {
+    const double p[4] = { n[0], n[1], n[2], d };
+    int k = 0;
+    for (int i = 0; i < 4; ++i)
+      for (int j = i; j < 4; ++j)
+        q[k++] += weight * p[i] * p[j];
+  }
+
+  Quadric &operator+=(const Quadric &o)
+  {
+    for (int i = 0; i < 10; ++i)
+      q[i] += o.q[i];
+    return *this;
+  }
+
+  double error(const Eigen::Vector3d &v) const
+  {
+    const double x = v[0], y = v[1], z = v[2];
+    double e = q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+             + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+             + q[7] * z * z + 2 * q[8] * z
+             + q[9];
+    return std::max(e, 0.0);
+  }
+};
+
+// Candidate collapse of vertex from onto vertex to. Entries are invalidated
+// by bumping the version of either vertex instead of updating the heap.
+struct Collapse
+{
+  double cost;
+  unsigned int from, to;
+  unsigned int fromVersion, toVersion;
+
+  bool operator<(const Collapse &o) const { return cost > o.cost; }
+};
+
+// Planes through border edges, perpendicular to their triangle, keep open
+// borders from shrinking. They weigh more than the surface planes.
+const double borderWeight = 10;
+
+class Simplifier
+{
+public:
+  Simplifier(const Eigen::MatrixXf &V, const std::vector<unsigned int> &F)
+    : positions(V.cols()), quadrics(V.cols()), adjacency(V.cols()),
+      versions(V.cols(), 0), removed(V.cols(), false),
+      triangles(F), alive(F.size() / 3, true), live(F.size() / 3), maxError(0)
+  {
+    for (Eigen::Index i = 0; i < V.cols(); ++i)
+      positions[i] = V.col(i).head<3>().cast<double>();
+
+    for (size_t t = 0; t < alive.size(); ++t)
+    {
+      const unsigned int *c = &triangles[t * 3];
+      Eigen::Vector3d n = (positions[c[1]] - positions[c[0]]).cross(positions[c[2]] - positions[c[0]]);
+      if (n.norm() > 0)
+        n.normalize();
+      Quadric plane;
+      plane.addPlane(n, -n.dot(positions[c[0]]), 1);
+      for (int k = 0; k < 3; ++k)
+      {
+        quadrics[c[k]] += plane;
+        adjacency[c[k]].push_back((unsigned int) t);
+      }
+    }
+
+    // Edges as (lower, higher, triangle) sorted so that border edges, which
+    // belong to a single triangle, and duplicates are adjacent
+    std::vector<std::pair<std::pair<unsigned int, unsigned int>, unsigned int> > edges;
+    edges.reserve(triangles.size());
+    for (size_t t = 0; t < alive.size(); ++t)
+      for (int k = 0; k < 3; ++k)
+      {
+        unsigned int a = triangles[t * 3 + k], b = triangles[t * 3 + (k + 1) % 3];
+        edges.push_back(std::make_pair(std::make_pair(std::min(a, b), std::max(a, b)), (unsigned int) t));
+      }
+    std::sort(edges.begin(), edges.end());
+
+    for (size_t i = 0; i < edges.size(); )
+    {
+      size_t j = i + 1;
+      while (j < edges.size() && edges[j].first == edges[i].first)
+        ++j;
+      unsigned int a = edges[i].first.first, b = edges[i].first.second;
+      if (j - i == 1)
+        addBorder(a, b, edges[i].second);
+      push(a, b);
+      i = j;
+    }
+  }
+
+  // Collapse edges until at most target triangles are left. Returns false
+  // if the mesh could not be simplified that far.
+  bool run(size_t target)
+  {
+    while (live > target && !heap.empty())
+    {
+      Collapse c = heap.top();
+      heap.pop();
+      if (removed[c.from] || removed[c.to] || versions[c.from] != c.fromVersion
+          || versions[c.to] != c.toVersion || !valid(c.from, c.to))
+        continue;
+      apply(c.from, c.to);
+      maxError = std::max(maxError, c.cost);
+    }
+    return live <= target;
+  }
+
+  // Append the remaining triangles in their original order
+  void emit(std::vector<unsigned int> &out) const
+  {
+    for (size_t t = 0; t < alive.size(); ++t)
+      if (alive[t])
+        out.insert(out.end(), triangles.begin() + t * 3, triangles.begin() + t * 3 + 3);
+  }
+
+  size_t triangleCount() const { return live; }
+
+  // Distance estimate of the worst collapse so far
+  float error() const { return (float) std::sqrt(maxError); }
+
+private:
+  void addBorder(unsigned int a, unsigned int b, unsigned int t)
+  {
+    const unsigned int *c = &triangles[t * 3];
+    Eigen::Vector3d n = (positions[c[1]] - positions[c[0]]).cross(positions[c[2]] - positions[c[0]]);
+    Eigen::Vector3d side = (positions[b] - positions[a]).cross(n);
+    if (side.norm() == 0)
+      return;
+    side.normalize();
+    Quadric plane;
+    plane.addPlane(side, -side.dot(positions[a]), borderWeight);
+    quadrics[a] += plane;
+    quadrics[b] += plane;
+  }
+
+  // Queue the cheaper direction of collapsing the edge a-b
+  void push(unsigned int a, unsigned int b)
+  {
+    Quadric q = quadrics[a];
+    q += quadrics[b];
+    double ab = q.error(positions[b]), ba = q.error(positions[a]);
+    Collapse c;
+    c.cost = std::min(ab, ba);
+    c.from = ab <= ba ? a : b;
+    c.to = ab <= ba ? b : a;
+    c.fromVersion = versions[c.from];
+    c.toVersion = versions[c.to];
+    heap.push(c);
+  }
+
+  bool contains(unsigned int t, unsigned int v) const
+  {
+    return triangles[t * 3] == v || triangles[t * 3 + 1] == v || triangles[t * 3 + 2] == v;
+  }
+
+  void neighbours(unsigned int v, std::vector<unsigned int> &out) const
+  {
+    out.clear();
+    for (size_t i = 0; i < adjacency[v].size(); ++i)
+    {
+      unsigned int t = adjacency[v][i];
+      if (!alive[t])
+        continue;
+      for (int k = 0; k < 3; ++k)
+        if (triangles[t * 3 + k] != v)
+          out.push_back(triangles[t * 3 + k]);
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+  }
+
+  // Reject collapses that fold triangles over or pinch the surface into a
+  // non-manifold shape
+  bool valid(unsigned int from, unsigned int to)
+  {
+    neighbours(from, fromRing);
+    neighbours(to, toRing);
+    if (!std::binary_search(fromRing.begin(), fromRing.end(), to))
+      return false;
+    size_t shared = 0;
+    for (size_t i = 0; i < fromRing.size(); ++i)
+      if (std::binary_search(toRing.begin(), toRing.end(), fromRing[i]))
+        ++shared;
+    if (shared > 2)
+      return false;
+
+    for (size_t i = 0; i < adjacency[from].size(); ++i)
+    {
+      unsigned int t = adjacency[from][i];
+      if (!alive[t] || contains(t, to))
+        continue;
+      Eigen::Vector3d p[3], moved[3];
+      for (int k = 0; k < 3; ++k)
+      {
+        unsigned int v = triangles[t * 3 + k];
+        p[k] = positions[v];
+        moved[k] = v == from ? positions[to] : positions[v];
+      }
+      Eigen::Vector3d before = (p[1] - p[0]).cross(p[2] - p[0]);
+      Eigen::Vector3d after = (moved[1] - moved[0]).cross(moved[2] - moved[0]);
+      if (after.dot(before) <= 0.2 * before.norm() * after.norm())
+        return false;
+    }
+    return true;
+  }
+
+  void apply(unsigned int from, unsigned int to)
+  {
+    for (size_t i = 0; i < adjacency[from].size(); ++i)
+    {
+      unsigned int t = adjacency[from][i];
+      if (!alive[t])
+        continue;
+      if (contains(t, to))
+      {
+        alive[t] = false;
+        --live;
+        continue;
+      }
+      for (int k = 0; k < 3; ++k)
+        if (triangles[t * 3 + k] == from)
+          triangles[t * 3 + k] = to;
+      adjacency[to].push_back(t);
+    }
+    adjacency[from].clear();
+    removed[from] = true;
+    quadrics[to] += quadrics[from];
+
+    // Drop dead triangles from the surviving vertex and requeue its edges
+    std::vector<unsigned int> &adj = adjacency[to];
+    size_t n = 0;
+    for (size_t i = 0; i < adj.size(); ++i)
+      if (alive[adj[i]])
+        adj[n++] = adj[i];
+    adj.resize(n);
+
+    ++versions[to];
+    neighbours(to, toRing);
+    for (size_t i = 0; i < toRing.size(); ++i)
+      push(to, toRing[i]);
+  }
+
+  std::vector<Eigen::Vector3d> positions;
+  std::vector<Quadric> quadrics;
+  std::vector<std::vector<unsigned int> > adjacency;
+  std::vector<unsigned int> versions;
+  std::vector<bool> removed;
+  std::vector<unsigned int> triangles;
+  std::vector<bool> alive;
+  size_t live;
+  std::priority_queue<Collapse> heap;
+  double maxError;
+
+  // Scratch rings reused by every validity check
+  std::vector<unsigned int> fromRing, toRing;
+};
+
+}
+
+void buildLevels(const Eigen::MatrixXf &V, std::vector<unsigned int> &F, unsigned int levels,
+                 std::vector<MeshLevel> &table)
+{
+  table.clear();
+  MeshLevel full = { 0, (uint32_t) F.size(), 0, 0 };
+  table.push_back(full);
+
+  // Levels come from one run of collapses, each snapshot taken when the
+  // triangle count reaches the next target, so the errors only increase
+  Simplifier simplifier(V, F);
+  size_t target = F.size() / 3;
+  for (unsigned int i = 0; i < levels; ++i)
+  {
+    target /= 2;
+    if (target == 0)
+      break;
+    size_t before = simplifier.triangleCount();
+    simplifier.run(target);
+
+    // Stop once the collapses no longer make a real difference
+    if (simplifier.triangleCount() * 10 > before * 9)
+      break;
+    MeshLevel level = { (uint32_t) F.size(), 0, simplifier.error(), 0 };
+    simplifier.emit(F);
+    level.count = (uint32_t) F.size() - level.first;
+    table.push_back(level);
+  }
+}
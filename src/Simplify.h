@@ -0,0 +1,18 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "Mesh.h"
+
+#include <vector>
+
+// Build a chain of levels of detail for the triangles F over the positions in
+// the first three rows of V. Every level has half the triangles of the
+// previous one and is appended to F; table receives the range of each level
+// starting with the full mesh. Levels come from quadric error edge collapses
+// (Garland and Heckbert 1997) that move a vertex onto a neighbour, so all of
+// them index the vertices of V and can share one vertex buffer. Fewer levels
+// are built when the mesh cannot be simplified further.
+void buildLevels(const Eigen::MatrixXf &V, std::vector<unsigned int> &F, unsigned int levels,
+                 std::vector<MeshLevel> &table);
+
+#endif
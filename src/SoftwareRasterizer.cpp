@@ -0,0 +1,355 @@
+#include "SoftwareRasterizer.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+  // Vertices per transform task, and the least triangles per binning task
+  const size_t vertexChunk = 16384;
+  const size_t triangleChunk = 4096;
+
+  // Smallest step of an edge function between vertices snapped to 1/256
+  // pixel and pixel centers
+  const double edgeStep = 1.0 / 65536;
+
+  double snap(double v)
+  {
+    return std::floor(v * 256 + 0.5) / 256;
+  }
+}
+
+Eigen::Vector3f shaderVertexColor(int colorMode, const Eigen::Vector3f &p, const Eigen::Vector3f &stored)
+{
+  if (colorMode == 1)
+    return p.cwiseProduct(p);
+  if (colorMode == 2)
+  {
+    float t = std::min(std::max(0.5f + 0.5f * p[1], 0.0f), 1.0f);
+    return Eigen::Vector3f(0.1f, 0.2f, 0.6f) * (1 - t) + Eigen::Vector3f(0.9f, 0.8f, 0.3f) * t;
+  }
+  if (colorMode == 3)
+    return p.cwiseAbs() / std::max(p.norm(), 1e-6f);
+  return stored;
+}
+
+unsigned char shaderFragmentChannel(float c)
+{
+  return (unsigned char) std::floor(std::min(std::max(c + 0.2f, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+void SoftwareMesh::init(const PackedVertices &vertices, const unsigned int *indices, size_t count)
+{
+  positions.resize(vertices.count);
+  colors.assign(vertices.count, Eigen::Vector3f::Zero());
+  this->indices.assign(indices, indices + count);
+
+  const unsigned char *data = (const unsigned char *) vertices.data;
+  const size_t stride = vertexSize(vertices.format);
+  const bool color = vertexHasColor(vertices.format);
+  const Eigen::Matrix4f dequantize = vertices.dequantize;
+  for (unsigned int i = 0; i < vertices.count; ++i, data += stride)
+  {
+    if (vertexIsQuantized(vertices.format))
+    {
+      unsigned short p[3];
+      memcpy(p, data, sizeof(p));
+      Eigen::Vector4f q(p[0] / 65535.0f, p[1] / 65535.0f, p[2] / 65535.0f, 1);
+      positions[i] = (dequantize * q).head<3>();
+      if (color)
+        colors[i] << data[8] / 255.0f, data[9] / 255.0f, data[10] / 255.0f;
+    }
+    else
+    {
+      float v[6];
+      memcpy(v, data, stride);
+      positions[i] << v[0], v[1], v[2];
+      if (color)
+        colors[i] << v[3], v[4], v[5];
+    }
+  }
+}
+
+SoftwareRasterizer::SoftwareRasterizer(ThreadPool *pool)
+  : width(0), height(0), wireframe(false), colorMode(0), triangles(0), trianglesBinned(0), setupSeconds(0),
+    rasterSeconds(0), pool(pool), tilesX(0), tilesY(0), chunks(0)
+{
+}
+
+void SoftwareRasterizer::resize(int width, int height)
+{
+  this->width = width;
+  this->height = height;
+  tilesX = (width + tileSize - 1) / tileSize;
+  tilesY = (height + tileSize - 1) / tileSize;
+  color.resize(size_t(width) * height * 3);
+  depth.resize(size_t(tilesX) * tilesY * tileSize * tileSize);
+  bins.clear();
+}
+
+void SoftwareRasterizer::clear()
+{
+  TRACE_SCOPE("software clear");
+  pool->parallelFor(tilesY, [this](size_t row) {
+    int y0 = int(row) * tileSize, y1 = std::min(y0 + tileSize, height);
+    std::fill(color.begin() + size_t(y0) * width * 3, color.begin() + size_t(y1) * width * 3, 0);
+    size_t tileArea = tileSize * tileSize;
+    std::fill(depth.begin() + row * tilesX * tileArea, depth.begin() + (row + 1) * tilesX * tileArea, 1.0f);
+  });
+}
+
+void SoftwareRasterizer::draw(const SoftwareMesh &mesh, const Eigen::Matrix4f &transform)
+{
+  TRACE_SCOPE("software draw");
+  if (width <= 0 || height <= 0)
+    return;
+  uint64_t start = traceNow();
+
+  // Vertex stage
+  size_t count = mesh.positions.size();
+  vertices.resize(count);
+  pool->parallelFor((count + vertexChunk - 1) / vertexChunk, [&](size_t chunk) {
+    transformVertices(mesh, transform, chunk * vertexChunk, std::min(count, (chunk + 1) * vertexChunk));
+  });
+
+  // Setup and binning, a few chunks per worker keep the bins small
+  size_t triangleCount = mesh.indices.size() / 3;
+  setup.resize(triangleCount);
+  size_t chunkSize = std::max(triangleChunk, (triangleCount + 2 * pool->size() - 1) / (2 * pool->size()));
+  chunks = (triangleCount + chunkSize - 1) / chunkSize;
+  if (bins.size() < chunks)
+    bins.resize(chunks);
+  binned.assign(chunks, 0);
+  pool->parallelFor(chunks, [&](size_t chunk) {
+    binTriangles(mesh, chunk, chunk * chunkSize, std::min(triangleCount, (chunk + 1) * chunkSize));
+  });
+  triangles += triangleCount;
+  for (size_t i = 0; i < chunks; ++i)
+    trianglesBinned += binned[i];
+  uint64_t binnedTime = traceNow();
+
+  // Tiles are independent, each one draws its triangles in order
+  pool->parallelFor(size_t(tilesX) * tilesY, [this](size_t tile) { rasterizeTile(tile); });
+  uint64_t end = traceNow();
+  setupSeconds += (binnedTime - start) * 1e-9;
+  rasterSeconds += (end - binnedTime) * 1e-9;
+}
+
+void SoftwareRasterizer::transformVertices(const SoftwareMesh &mesh, const Eigen::Matrix4f &transform,
+                                           size_t begin, size_t end)
+{
+  for (size_t i = begin; i < end; ++i)
+  {
+    Vertex &v = vertices[i];
+    const Eigen::Vector3f &p = mesh.positions[i];
+    Eigen::Vector4f clip = transform * Eigen::Vector4f(p[0], p[1], p[2], 1);
+
+    // Without clipping, triangles reaching behind the camera are dropped
+    v.visible = clip[3] > 0;
+    v.invW = v.visible ? 1 / clip[3] : 0;
+    v.x = snap((clip[0] * v.invW + 1) * 0.5 * width);
+    v.y = snap((1 - clip[1] * v.invW) * 0.5 * height);
+    v.z = (clip[2] * v.invW + 1) * 0.5f;
+    v.color = shaderVertexColor(colorMode, p, mesh.colors[i]);
+  }
+}
+
+bool SoftwareRasterizer::setupTriangle(const unsigned int *index, Triangle &triangle) const
+{
+  const Vertex *v[3] = { &vertices[index[0]], &vertices[index[1]], &vertices[index[2]] };
+  if (!v[0]->visible || !v[1]->visible || !v[2]->visible)
+    return false;
+
+  // Counterclockwise on screen, so that the inside is positive for every edge
+  double area = (v[1]->x - v[0]->x) * (v[2]->y - v[0]->y) - (v[1]->y - v[0]->y) * (v[2]->x - v[0]->x);
+  if (area == 0)
+    return false;
+  triangle.vertex[0] = index[0];
+  triangle.vertex[1] = area > 0 ? index[1] : index[2];
+  triangle.vertex[2] = area > 0 ? index[2] : index[1];
+  if (area < 0)
+  {
+    std::swap(v[1], v[2]);
+    area = -area;
+  }
+  triangle.area = area;
+
+  // Depth entirely in front of the near or behind the far plane
+  if ((v[0]->z < 0 && v[1]->z < 0 && v[2]->z < 0) || (v[0]->z > 1 && v[1]->z > 1 && v[2]->z > 1))
+    return false;
+
+  double minX = std::min(v[0]->x, std::min(v[1]->x, v[2]->x)), maxX = std::max(v[0]->x, std::max(v[1]->x, v[2]->x));
+  double minY = std::min(v[0]->y, std::min(v[1]->y, v[2]->y)), maxY = std::max(v[0]->y, std::max(v[1]->y, v[2]->y));
+  if (maxX < 0 || maxY < 0 || minX > width || minY > height)
+    return false;
+  triangle.x0 = int(std::max(0.0, std::floor(minX)));
+  triangle.y0 = int(std::max(0.0, std::floor(minY)));
+  triangle.x1 = int(std::min(width - 1.0, std::ceil(maxX)));
+  triangle.y1 = int(std::min(height - 1.0, std::ceil(maxY)));
+
+  for (int i = 0; i < 3; ++i)
+  {
+    // Edge from s to t, opposite vertex i
+    const Vertex &s = *v[(i + 1) % 3], &t = *v[(i + 2) % 3];
+    double dx = t.x - s.x, dy = t.y - s.y;
+    triangle.a[i] = -dy;
+    triangle.b[i] = dx;
+    triangle.c[i] = dy * s.x - dx * s.y;
+
+    // Top-left rule: pixel centers on an edge belong to the triangle only
+    // if the edge is a top edge or a left one
+    bool topLeft = (dy == 0 && dx > 0) || dy < 0;
+    triangle.bias[i] = topLeft ? 0 : -edgeStep;
+  }
+  return true;
+}
+
+void SoftwareRasterizer::binTriangles(const SoftwareMesh &mesh, size_t chunk, size_t begin, size_t end)
+{
+  std::vector<std::vector<unsigned int> > &tiles = bins[chunk];
+  tiles.resize(size_t(tilesX) * tilesY);
+  for (size_t i = 0; i < tiles.size(); ++i)
+    tiles[i].clear();
+
+  for (size_t t = begin; t < end; ++t)
+  {
+    Triangle &triangle = setup[t];
+    if (!setupTriangle(&mesh.indices[3 * t], triangle))
+      continue;
+    ++binned[chunk];
+    for (int ty = triangle.y0 / tileSize; ty <= triangle.y1 / tileSize; ++ty)
+      for (int tx = triangle.x0 / tileSize; tx <= triangle.x1 / tileSize; ++tx)
+        tiles[ty * tilesX + tx].push_back((unsigned int) t);
+  }
+}
+
+void SoftwareRasterizer::rasterizeTile(size_t tile)
+{
+  int tx0 = int(tile % tilesX) * tileSize, ty0 = int(tile / tilesX) * tileSize;
+  int tx1 = std::min(tx0 + tileSize, width), ty1 = std::min(ty0 + tileSize, height);
+  float *tileDepth = &depth[tile * tileSize * tileSize];
+  for (size_t chunk = 0; chunk < chunks; ++chunk)
+  {
+    const std::vector<unsigned int> &list = bins[chunk][tile];
+    for (size_t i = 0; i < list.size(); ++i)
+    {
+      const Triangle &triangle = setup[list[i]];
+      if (!wireframe)
+      {
+        fillTriangle(triangle, tx0, ty0, tx1, ty1, tileDepth);
+        continue;
+      }
+      for (int e = 0; e < 3; ++e)
+        drawLine(vertices[triangle.vertex[e]], vertices[triangle.vertex[(e + 1) % 3]], tx0, ty0, tx1, ty1, tileDepth);
+    }
+  }
+}
+
+void SoftwareRasterizer::fillTriangle(const Triangle &triangle, int tx0, int ty0, int tx1, int ty1, float *tileDepth)
+{
+  int xs = std::max(triangle.x0, tx0), xe = std::min(triangle.x1, tx1 - 1);
+  int ys = std::max(triangle.y0, ty0), ye = std::min(triangle.y1, ty1 - 1);
+  if (xs > xe || ys > ye)
+    return;
+
+  const Vertex &v0 = vertices[triangle.vertex[0]];
+  const Vertex &v1 = vertices[triangle.vertex[1]];
+  const Vertex &v2 = vertices[triangle.vertex[2]];
+  const double invArea = 1 / triangle.area;
+
+  // Colors are interpolated in perspective, divided by w at the vertices
+  const Eigen::Vector3f c0 = v0.color * v0.invW, c1 = v1.color * v1.invW, c2 = v2.color * v2.invW;
+
+  const double *a = triangle.a;
+  const int n = xe - xs + 1;
+  unsigned char inside[tileSize];
+  for (int y = ys; y <= ye; ++y)
+  {
+    double px = xs + 0.5, py = y + 0.5;
+    double e0 = a[0] * px + triangle.b[0] * py + triangle.c[0];
+    double e1 = a[1] * px + triangle.b[1] * py + triangle.c[1];
+    double e2 = a[2] * px + triangle.b[2] * py + triangle.c[2];
+
+    // Coverage of the whole span first, a loop compilers vectorize
+    const double f0 = e0 + triangle.bias[0], f1 = e1 + triangle.bias[1], f2 = e2 + triangle.bias[2];
+    bool any = false;
+    for (int i = 0; i < n; ++i)
+    {
+      inside[i] = (f0 + i * a[0] >= 0) & (f1 + i * a[1] >= 0) & (f2 + i * a[2] >= 0);
+      any |= inside[i] != 0;
+    }
+    if (!any)
+      continue;
+
+    float *depthRow = tileDepth + (y - ty0) * tileSize + (xs - tx0);
+    for (int i = 0; i < n; ++i)
+    {
+      if (!inside[i])
+        continue;
+      float l0 = float((e0 + i * a[0]) * invArea);
+      float l1 = float((e1 + i * a[1]) * invArea);
+      float l2 = float((e2 + i * a[2]) * invArea);
+      float z = l0 * v0.z + l1 * v1.z + l2 * v2.z;
+      if (z < 0 || z > 1 || z >= depthRow[i])
+        continue;
+      float q = l0 * v0.invW + l1 * v1.invW + l2 * v2.invW;
+      writeFragment(xs + i, y, z, (l0 * c0 + l1 * c1 + l2 * c2) / q, &depthRow[i]);
+    }
+  }
+}
+
+void SoftwareRasterizer::drawLine(const Vertex &from, const Vertex &to, int tx0, int ty0, int tx1, int ty1,
+                                  float *tileDepth)
+{
+  // One pixel per column or row along the major axis, pixel centers from
+  // the start up to but not including the end
+  double dx = to.x - from.x, dy = to.y - from.y;
+  bool xMajor = std::abs(dx) >= std::abs(dy);
+  double d = xMajor ? dx : dy;
+  if (d == 0)
+    return;
+  double origin = xMajor ? from.x : from.y, minorOrigin = xMajor ? from.y : from.x, slope = (xMajor ? dy : dx) / d;
+  int first = int(std::ceil(std::min(origin, origin + d) - 0.5));
+  int last = int(std::ceil(std::max(origin, origin + d) - 0.5)) - 1;
+  first = std::max(first, xMajor ? tx0 : ty0);
+  last = std::min(last, (xMajor ? tx1 : ty1) - 1);
+
+  const Eigen::Vector3f c0 = from.color * from.invW, c1 = to.color * to.invW;
+  for (int k = first; k <= last; ++k)
+  {
+    double center = k + 0.5;
+    int m = int(std::floor(minorOrigin + (center - origin) * slope));
+    int x = xMajor ? k : m, y = xMajor ? m : k;
+    if (x < tx0 || x >= tx1 || y < ty0 || y >= ty1)
+      continue;
+    float t = float((center - origin) / d);
+    float z = from.z + t * (to.z - from.z);
+    float *slot = &tileDepth[(y - ty0) * tileSize + (x - tx0)];
+    if (z < 0 || z > 1 || z >= *slot)
+      continue;
+    float q = (1 - t) * from.invW + t * to.invW;
+    writeFragment(x, y, z, ((1 - t) * c0 + t * c1) / q, slot);
+  }
+}
+
+void SoftwareRasterizer::writeFragment(int x, int y, float z, const Eigen::Vector3f &c, float *depth)
+{
+  *depth = z;
+  unsigned char *out = &color[(size_t(y) * width + x) * 3];
+  out[0] = shaderFragmentChannel(c[0]);
+  out[1] = shaderFragmentChannel(c[1]);
+  out[2] = shaderFragmentChannel(c[2]);
+}
+
+void SoftwareRasterizer::read(std::vector<unsigned char> &rgb) const
+{
+  rgb = color;
+}
+
+void SoftwareRasterizer::resetStats()
+{
+  triangles = trianglesBinned = 0;
+  setupSeconds = rasterSeconds = 0;
+}
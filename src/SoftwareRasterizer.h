@@ -0,0 +1,144 @@
+#ifndef SOFTWARERASTERIZER_H
+#define SOFTWARERASTERIZER_H
+
+#include "VertexFormat.h"
+#include "ThreadPool.h"
+
+#include <vector>
+#include <Eigen/Core>
+
+// Vertices and triangles of a mesh decoded for drawing on the CPU, from the
+// same packed vertices and indices that are uploaded to the GPU. Quantized
+// positions are dequantized, so the positions are in model space.
+class SoftwareMesh
+{
+public:
+  std::vector<Eigen::Vector3f> positions;
+
+  // Stored colors, black like the GL default attribute when the format
+  // has none
+  std::vector<Eigen::Vector3f> colors;
+
+  std::vector<unsigned int> indices;
+
+  // Decode the vertices and copy count indices
+  void init(const PackedVertices &vertices, const unsigned int *indices, size_t count);
+};
+
+// The vertex shader's color for a model space position: the stored color
+// for colorMode 0, else the procedural function of colorMode 1 squared
+// position, 2 height or 3 direction
+Eigen::Vector3f shaderVertexColor(int colorMode, const Eigen::Vector3f &position, const Eigen::Vector3f &stored);
+
+// The fragment shader's +0.2 ambient applied to one color channel, clamped
+// and rounded like a write to an 8 bit color buffer
+unsigned char shaderFragmentChannel(float c);
+
+// Draws triangles on the CPU with the pipeline of the viewer's shaders:
+// positions transformed by one matrix, colors interpolated from the
+// vertices (stored or one of the procedural color modes), +0.2 ambient,
+// a less-than depth test against a cleared depth of 1, and fill or
+// wireframe polygon mode. There is no face culling.
+//
+// Each draw transforms the vertices, sets up the triangles and bins them
+// into 64x64 pixel tiles, in chunks on the pool. Then every tile is
+// rasterized by one task, keeping the submission order, with edge
+// functions evaluated over rows of pixels and a depth buffer stored per
+// tile. Vertices are snapped to 1/256 pixel, which keeps the edge
+// functions exact so that shared edges are covered once.
+class SoftwareRasterizer
+{
+public:
+  static const int tileSize = 64;
+
+  int width;
+  int height;
+
+  // Draw triangle outlines instead of filling them
+  bool wireframe;
+
+  // Color function of the vertex shader, see shaderVertexColor
+  int colorMode;
+
+  // Triangles drawn, and those binned after rejecting the ones that are
+  // degenerate, behind the camera or off screen
+  size_t triangles;
+  size_t trianglesBinned;
+
+  // Seconds spent transforming and binning, and rasterizing the tiles
+  double setupSeconds;
+  double rasterSeconds;
+
+  explicit SoftwareRasterizer(ThreadPool *pool);
+
+  // Resize the color and depth buffers, their contents are undefined
+  void resize(int width, int height);
+
+  // Clear the color to black and the depth to 1
+  void clear();
+
+  // Draw the triangles of mesh, transform maps model space to clip space
+  void draw(const SoftwareMesh &mesh, const Eigen::Matrix4f &transform);
+
+  // The color buffer as RGB rows from top to bottom
+  void read(std::vector<unsigned char> &rgb) const;
+
+  // Restart the triangle counts and times
+  void resetStats();
+
+private:
+  SoftwareRasterizer(const SoftwareRasterizer &);
+  SoftwareRasterizer &operator=(const SoftwareRasterizer &);
+
+  // A transformed vertex in pixels, rows from the top, with the window
+  // depth from 0 to 1
+  class Vertex
+  {
+  public:
+    double x, y;
+    float z, invW;
+    Eigen::Vector3f color;
+    bool visible;
+  };
+
+  // A triangle ready for rasterization, counterclockwise on screen
+  class Triangle
+  {
+  public:
+    unsigned int vertex[3];
+
+    // Edge i is opposite vertex i: e(x, y) = a * x + b * y + c, inside
+    // where e(x, y) + bias >= 0
+    double a[3], b[3], c[3], bias[3];
+    double area;
+
+    // Pixel bounds, inclusive
+    int x0, y0, x1, y1;
+  };
+
+  void transformVertices(const SoftwareMesh &mesh, const Eigen::Matrix4f &transform, size_t begin, size_t end);
+  bool setupTriangle(const unsigned int *index, Triangle &triangle) const;
+  void binTriangles(const SoftwareMesh &mesh, size_t chunk, size_t begin, size_t end);
+  void rasterizeTile(size_t tile);
+  void fillTriangle(const Triangle &triangle, int tx0, int ty0, int tx1, int ty1, float *tileDepth);
+  void drawLine(const Vertex &from, const Vertex &to, int tx0, int ty0, int tx1, int ty1, float *tileDepth);
+  void writeFragment(int x, int y, float z, const Eigen::Vector3f &color, float *depth);
+
+  ThreadPool *pool;
+  int tilesX, tilesY;
+
+  // RGB rows from the top, and depth stored tile by tile
+  std::vector<unsigned char> color;
+  std::vector<float> depth;
+
+  std::vector<Vertex> vertices;
+  std::vector<Triangle> setup;
+
+  // Triangles per tile found by each chunk of the current draw, in
+  // submission order
+  size_t chunks;
+  std::vector<std::vector<std::vector<unsigned int> > > bins;
+  std::vector<size_t> binned;
+};
+
+#endif
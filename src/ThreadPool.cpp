@@ -0,0 +1,88 @@
+#include "ThreadPool.h"
+#include "Trace.h"
+
+ThreadPool::ThreadPool(unsigned int threads) : pending(0), stopping(false)
+{
+  if (threads == 0)
+    threads = std::thread::hardware_concurrency();
+  if (threads == 0)
+    threads = 1;
+  for (unsigned int i = 0; i < threads; ++i)
+    workers.push_back(std::thread(&ThreadPool::run, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  available.notify_all();
+  for (size_t i = 0; i < workers.size(); ++i)
+    workers[i].join();
+}
+
+void ThreadPool::submit(const std::function<void()> &task)
+{
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    tasks.push_back(task);
+    ++pending;
+  }
+  available.notify_one();
+}
+
+void ThreadPool::wait()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while (pending > 0)
+    finished.wait(lock);
+}
+
+void ThreadPool::parallelFor(size_t n, const std::function<void(size_t)> &fn)
+{
+  // Tasks are counted separately from the queue so that other work queued on
+  // the pool does not delay the return
+  std::mutex doneMutex;
+  std::condition_variable doneCondition;
+  size_t remaining = n;
+
+  for (size_t i = 0; i < n; ++i)
+  {
+    submit([&, i]()
+    {
+      fn(i);
+      std::unique_lock<std::mutex> lock(doneMutex);
+      if (--remaining == 0)
+        doneCondition.notify_all();
+    });
+  }
+
+  std::unique_lock<std::mutex> lock(doneMutex);
+  while (remaining > 0)
+    doneCondition.wait(lock);
+}
+
+void ThreadPool::run()
+{
+  setTraceThreadName("pool worker");
+  for (;;)
+  {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (!stopping && tasks.empty())
+        available.wait(lock);
+      if (tasks.empty())
+        return;
+      task = tasks.front();
+      tasks.pop_front();
+    }
+
+    task();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (--pending == 0)
+      finished.notify_all();
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <cstddef>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Fixed set of worker threads consuming a FIFO of tasks
+class ThreadPool
+{
+public:
+  // Start threads workers, 0 uses one per hardware thread
+  explicit ThreadPool(unsigned int threads = 0);
+
+  // Finish the queued tasks and join the workers
+  ~ThreadPool();
+
+  // Number of worker threads
+  unsigned int size() const { return (unsigned int) workers.size(); }
+
+  // Queue a task to run on one of the workers
+  void submit(const std::function<void()> &task);
+
+  // Block until every queued task has finished
+  void wait();
+
+  // Run fn(i) for every i in [0, n) on the workers and wait for all of them.
+  // Must not be called from inside a task of the same pool.
+  void parallelFor(size_t n, const std::function<void(size_t)> &fn);
+
+private:
+  ThreadPool(const ThreadPool &);
+  ThreadPool &operator=(const ThreadPool &);
+
+  void run();
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()> > tasks;
+  std::mutex mutex;
+  std::condition_variable available;
+  std::condition_variable finished;
+  size_t pending;
+  bool stopping;
+};
+
+#endif
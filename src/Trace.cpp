@@ -0,0 +1,168 @@
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> traceEnabled(true);
+
+namespace
+{
+  // Fields are atomics so that an export can read them while the owning
+  // thread overwrites them; relaxed accesses compile to plain moves
+  class TraceEvent
+  {
+  public:
+    std::atomic<const char *> name;
+    std::atomic<uint64_t> start, end;
+  };
+
+  // Events of one thread. Only the owning thread writes; head counts all
+  // events ever written and is published after each one. Writing event
+  // head overwrites event head - capacity, so a reader that copied events
+  // checks head again afterwards and drops those that may have been
+  // overwritten meanwhile, like a sequence lock.
+  class TraceRing
+  {
+  public:
+    static const size_t capacity = 1 << 14;
+
+    TraceEvent events[capacity];
+    std::atomic<uint64_t> head;
+    int id;
+    std::string name;
+
+    TraceRing() : head(0), id(0) {}
+  };
+
+  // Rings outlive their threads so that their events can still be exported
+  std::mutex ringsMutex;
+  std::vector<std::unique_ptr<TraceRing> > rings;
+
+  // An event copied out of a ring
+  class Event
+  {
+  public:
+    const char *name;
+    uint64_t start, end;
+  };
+
+  thread_local TraceRing *ring = 0;
+
+  TraceRing &threadRing()
+  {
+    if (!ring)
+    {
+      std::lock_guard<std::mutex> lock(ringsMutex);
+      rings.push_back(std::unique_ptr<TraceRing>(new TraceRing()));
+      ring = rings.back().get();
+      ring->id = (int) rings.size();
+    }
+    return *ring;
+  }
+
+  void writeString(std::ostream &out, const std::string &s)
+  {
+    out << '"';
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+      if (s[i] == '"' || s[i] == '\\')
+        out << '\\';
+      out << s[i];
+    }
+    out << '"';
+  }
+}
+
+void setTraceThreadName(const std::string &name)
+{
+  TraceRing &r = threadRing();
+  std::lock_guard<std::mutex> lock(ringsMutex);
+  r.name = name;
+}
+
+uint64_t traceNow()
+{
+  static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void traceRecord(const char *name, uint64_t start, uint64_t end)
+{
+  TraceRing &r = threadRing();
+  uint64_t head = r.head.load(std::memory_order_relaxed);
+  TraceEvent &e = r.events[head % TraceRing::capacity];
+
+  // A reader that sees any of the writes below also sees this head
+  std::atomic_thread_fence(std::memory_order_release);
+  e.name.store(name, std::memory_order_relaxed);
+  e.start.store(start, std::memory_order_relaxed);
+  e.end.store(end, std::memory_order_relaxed);
+  r.head.store(head + 1, std::memory_order_release);
+}
+
+bool writeChromeTrace(const std::string &path)
+{
+  std::ofstream out(path.c_str());
+  if (!out)
+  {
+    std::cerr << "Cannot write " << path << std::endl;
+    return false;
+  }
+
+  // Microseconds with nanosecond digits
+  out.setf(std::ios::fixed);
+  out.precision(3);
+
+  std::lock_guard<std::mutex> lock(ringsMutex);
+  out << "{\"traceEvents\":[" << std::endl;
+  bool first = true;
+  size_t count = 0;
+  for (size_t i = 0; i < rings.size(); ++i)
+  {
+    const TraceRing &r = *rings[i];
+    if (!r.name.empty())
+    {
+      out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << r.id
+          << ",\"args\":{\"name\":";
+      writeString(out, r.name);
+      out << "}}";
+      first = false;
+    }
+
+    // Copy the events, then keep those the owning thread has not started
+    // to overwrite since
+    uint64_t head = r.head.load(std::memory_order_acquire);
+    uint64_t begin = head > TraceRing::capacity ? head - TraceRing::capacity : 0;
+    std::vector<Event> copied(head - begin);
+    for (uint64_t j = begin; j < head; ++j)
+    {
+      const TraceEvent &e = r.events[j % TraceRing::capacity];
+      Event &c = copied[j - begin];
+      c.name = e.name.load(std::memory_order_relaxed);
+      c.start = e.start.load(std::memory_order_relaxed);
+      c.end = e.end.load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t overwritten = r.head.load(std::memory_order_relaxed);
+    uint64_t valid = overwritten >= TraceRing::capacity ? overwritten - TraceRing::capacity + 1 : 0;
+
+    for (uint64_t j = std::max(begin, valid); j < head; ++j)
+    {
+      const Event &e = copied[j - begin];
+      out << (first ? "" : ",\n") << "{\"name\":";
+      writeString(out, e.name);
+      out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << r.id << ",\"ts\":" << e.start / 1000.0
+          << ",\"dur\":" << (e.end - e.start) / 1000.0 << "}";
+      first = false;
+      ++count;
+    }
+  }
+  out << "\n]}" << std::endl;
+  std::cout << "Wrote " << count << " trace events to " << path << std::endl;
+  return bool(out);
+}
@@ -0,0 +1,61 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Timed CPU scopes recorded into a ring buffer per thread. Recording a
+// scope reads the clock twice and writes one entry into the thread's own
+// ring, without locks or allocation, so it can stay on in release builds.
+// Each ring keeps the most recent events; older ones are overwritten.
+//
+// Usage
+//   void draw()
+//   {
+//     TRACE_SCOPE("draw");
+//     ...
+//   }
+
+// Whether scopes are recorded, on by default
+extern std::atomic<bool> traceEnabled;
+
+// Name the calling thread in exported traces
+void setTraceThreadName(const std::string &name);
+
+// Nanoseconds since the first call
+uint64_t traceNow();
+
+// Add a finished scope to the calling thread's ring. The name is kept as a
+// pointer and must be a string literal.
+void traceRecord(const char *name, uint64_t start, uint64_t end);
+
+// Write the events still held by all rings in the Chrome trace event
+// format, for chrome://tracing or Perfetto. False if the file cannot be
+// written. Events being recorded meanwhile may be left out.
+bool writeChromeTrace(const std::string &path);
+
+// Records the lifetime of the enclosing block
+class TraceScope
+{
+public:
+  explicit TraceScope(const char *name)
+    : name(traceEnabled.load(std::memory_order_relaxed) ? name : 0), start(this->name ? traceNow() : 0) {}
+  ~TraceScope() { end(); }
+
+  // Record the scope now instead of at the end of the block
+  void end() { if (name) traceRecord(name, start, traceNow()); name = 0; }
+
+private:
+  TraceScope(const TraceScope &);
+  TraceScope &operator=(const TraceScope &);
+
+  const char *name;
+  uint64_t start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif
@@ -0,0 +1,134 @@
+#include "VertexFormat.h"
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+size_t vertexSize(VertexFormat format)
+{
+  switch (format)
+  {
+    case VERTEX_COMPACT:          return 12;
+    case VERTEX_POSITION:         return 12;
+    case VERTEX_COMPACT_POSITION: return 8;
+    default:                      return 24;
+  }
+}
+
+bool vertexHasColor(VertexFormat format)
+{
+  return format == VERTEX_FLOAT || format == VERTEX_COMPACT;
+}
+
+bool vertexIsQuantized(VertexFormat format)
+{
+  return format == VERTEX_COMPACT || format == VERTEX_COMPACT_POSITION;
+}
+
+const char *vertexFormatName(VertexFormat format)
+{
+  switch (format)
+  {
+    case VERTEX_COMPACT:          return "compact";
+    case VERTEX_POSITION:         return "position";
+    case VERTEX_COMPACT_POSITION: return "compact-position";
+    default:                      return "float";
+  }
+}
+
+bool parseVertexFormat(const std::string &name, VertexFormat &format)
+{
+  if (name == "float")
+    format = VERTEX_FLOAT;
+  else if (name == "compact")
+    format = VERTEX_COMPACT;
+  else if (name == "position")
+    format = VERTEX_POSITION;
+  else if (name == "compact-position")
+    format = VERTEX_COMPACT_POSITION;
+  else
+    return false;
+  return true;
+}
+
+namespace
+{
+
+unsigned short quantize16(float v)
+{
+  return (unsigned short) std::floor(std::min(std::max(v, 0.0f), 1.0f) * 65535.0f + 0.5f);
+}
+
+unsigned char quantize8(float v)
+{
+  return (unsigned char) std::floor(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+}
+
+void packVertices(const float *vertices, unsigned int rows, unsigned int cols,
+                  VertexFormat format, PackedVertices &packed)
+{
+  packed.format = format;
+  packed.count = cols;
+  packed.dequantize.setIdentity();
+  packed.storage.clear();
+
+  // Float layouts matching the source are used in place
+  if ((format == VERTEX_FLOAT && rows == 6) || (format == VERTEX_POSITION && rows == 3))
+  {
+    packed.data = vertices;
+    packed.size = sizeof(float) * rows * cols;
+    return;
+  }
+
+  Eigen::Map<const Eigen::MatrixXf> V(vertices, rows, cols);
+  const size_t stride = vertexSize(format);
+  packed.storage.resize(stride * cols);
+  packed.data = packed.storage.data();
+  packed.size = packed.storage.size();
+  unsigned char *out = packed.storage.data();
+
+  if (!vertexIsQuantized(format))
+  {
+    for (unsigned int i = 0; i < cols; ++i, out += stride)
+    {
+      float v[6] = { V(0, i), V(1, i), V(2, i), 1, 1, 1 };
+      for (unsigned int k = 3; k < 6 && k < rows; ++k)
+        v[k] = V(k, i);
+      memcpy(out, v, stride);
+    }
+    return;
+  }
+
+  // Positions are stored as fractions of the bounding box. Unsigned
+  // normalization is used because its conversion rule (c / 65535) is the
+  // same in every GL version, unlike the signed one.
+  Eigen::Vector3f lo = Eigen::Vector3f::Zero(), extent = Eigen::Vector3f::Ones();
+  if (cols > 0)
+  {
+    lo = V.topRows(3).rowwise().minCoeff();
+    extent = V.topRows(3).rowwise().maxCoeff() - lo;
+    for (int i = 0; i < 3; ++i)
+      if (extent[i] <= 0)
+        extent[i] = 1;
+  }
+  packed.dequantize.block<3, 3>(0, 0) = extent.asDiagonal();
+  packed.dequantize.block<3, 1>(0, 3) = lo;
+
+  // 4 shorts for the position (the last one pads to 8 bytes), 4 bytes color
+  const bool color = vertexHasColor(format);
+  for (unsigned int i = 0; i < cols; ++i, out += stride)
+  {
+    unsigned short p[4];
+    for (int k = 0; k < 3; ++k)
+      p[k] = quantize16((V(k, i) - lo[k]) / extent[k]);
+    p[3] = 0;
+    memcpy(out, p, sizeof(p));
+    if (!color)
+      continue;
+    for (int k = 0; k < 3; ++k)
+      out[8 + k] = rows >= 6 ? quantize8(V(3 + k, i)) : 255;
+    out[11] = 255;
+  }
+}
@@ -0,0 +1,67 @@
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <Eigen/Core>
+
+// Layout of the vertices stored on the GPU
+enum VertexFormat
+{
+  // 3 float position + 3 float color, 24 bytes
+  VERTEX_FLOAT,
+
+  // 16 bit unsigned normalized position quantized against the bounding box
+  // + RGBA8 color, 12 bytes
+  VERTEX_COMPACT,
+
+  // 3 float position only, the color is computed in the vertex shader,
+  // 12 bytes
+  VERTEX_POSITION,
+
+  // Quantized position only, 8 bytes
+  VERTEX_COMPACT_POSITION
+};
+
+// Bytes per vertex of a format
+size_t vertexSize(VertexFormat format);
+
+// True if the format stores a color per vertex
+bool vertexHasColor(VertexFormat format);
+
+// True if the format stores positions quantized against the bounding box
+bool vertexIsQuantized(VertexFormat format);
+
+// Name used on the command line, and the reverse lookup. Unknown names
+// return false.
+const char *vertexFormatName(VertexFormat format);
+bool parseVertexFormat(const std::string &name, VertexFormat &format);
+
+// Vertices converted to a GPU format. For VERTEX_FLOAT, data points to the
+// source vertices without a copy, so they must outlive this object.
+class PackedVertices
+{
+public:
+  VertexFormat format;
+  const void *data;
+  size_t size;
+  unsigned int count;
+
+  // Maps the stored positions back to model space. Quantized positions are
+  // decoded by this transform in the vertex shader.
+  Eigen::Matrix<float, 4, 4, Eigen::DontAlign> dequantize;
+
+  // Packed bytes when a conversion was needed
+  std::vector<unsigned char> storage;
+
+  PackedVertices() : format(VERTEX_FLOAT), data(0), size(0), count(0),
+                     dequantize(Eigen::Matrix4f::Identity()) {}
+};
+
+// Convert cols interleaved vertices of rows floats (x, y, z and optionally
+// r, g, b) to format
+void packVertices(const float *vertices, unsigned int rows, unsigned int cols,
+                  VertexFormat format, PackedVertices &packed);
+
+#endif
@@ -10,16 +10,156 @@
 #include <Eigen/Core>
 #include <Eigen/Dense>
 
-// File reading libraries
+// OFF mesh loading and GPU residency
+#include "MeshLoader.h"
+#include "MeshRegistry.h"
+#include "ThreadPool.h"
+#include "InstanceBuffer.h"
+#include "GeometryArena.h"
+#include "GLState.h"
+#include "GpuProfiler.h"
+#include "Trace.h"
+#include "HeadlessContext.h"
+#include "ImageWriter.h"
+#include "FrameCapture.h"
+#include "SoftwareRasterizer.h"
+#include "RayTracer.h"
 #include <string>
-#include <fstream>
+#include <deque>
 #include <sstream>
+#include <iostream>
+#include <memory>
+#include <cstdlib>
+#include <cstring>
 
 // Sin, Cos, and Pow functions
 #include <cmath>
 
-// VertexBufferObject wrapper
-VertexBufferObject VBO;
+// Meshes resident on the GPU, keyed by source path
+MeshRegistry registry;
+
+// The mesh on screen, owned by the registry
+GpuMesh * current = 0;
+
+// GPU layout of the vertices, see --vertex-format
+VertexFormat vertexFormat = VERTEX_FLOAT;
+
+// Procedural color functions of the vertex shader, selected with C
+enum ColorMode { COLOR_STORED, COLOR_SQUARED, COLOR_HEIGHT, COLOR_DIRECTION, COLOR_MODES };
+const char * colorModeNames[COLOR_MODES] = { "stored", "squared position", "height", "direction" };
+int colorMode = COLOR_STORED;
+
+// Draw with OpenGL, or on the CPU without a GL context, see --renderer.
+// The software renderers draw the single mesh offscreen like --headless.
+enum Renderer { RENDERER_GL, RENDERER_SOFTWARE, RENDERER_RAYTRACE, RENDERERS };
+const char * rendererNames[RENDERERS] = { "gl", "software", "raytrace" };
+int renderer = RENDERER_GL;
+
+// The mesh on screen decoded for the software renderers
+SoftwareMesh softwareMesh;
+
+// Shadows and ambient occlusion rays per pixel of the ray tracer, see
+// --shadows and --ao
+bool shadows = false;
+unsigned int aoSamples = 0;
+
+// Start with triangle outlines, as after W, see --wireframe
+bool wireframe = false;
+
+// Cull back faces of filled triangles, and skip the meshlets facing away on
+// the CPU too. B toggles it, see --cull-faces
+bool cullFaces = false;
+
+// Triangle and vertex reordering applied on import, see --optimize
+MeshOptimization meshOptimization = OPTIMIZE_NONE;
+
+// Simplified levels of detail built per mesh and the screen space error in
+// pixels allowed when picking one, see --lod and --lod-error
+unsigned int lodLevels = 3;
+float lodThreshold = 1;
+
+// Split meshes into meshlets and cull them every frame, see --no-meshlets
+bool meshletCulling = true;
+
+// Culling counts since the last statistics line
+CullStats cullStats;
+
+// Copies of the current mesh drawn with one instanced call, see --instances.
+// I switches between them and the single mesh.
+InstanceBuffer instances;
+unsigned int instanceCount = 0;
+float instanceScale = 1;
+bool instancing = false;
+
+// Meshes shown side by side from one geometry arena, drawn with a single
+// VAO bind. 4 shows the gallery, shift 4 moves its first mesh to the end.
+// Meshes are imported in the background and join the gallery once uploaded.
+struct GalleryItem {
+	std::string path;
+	ImportSettings settings;
+	int handle;
+};
+GeometryArena arena;
+std::deque<GalleryItem> gallery;
+bool showGallery = false;
+
+// Gallery meshes waiting to be imported, the first one is in flight while
+// galleryLoading is set
+std::deque<GalleryItem> galleryQueue;
+bool galleryLoading = false;
+
+// Matrices of the vertex shader, uploaded together as one std140 block
+struct Transforms {
+	Eigen::Matrix<float, 4, 4, Eigen::DontAlign> projection;
+	Eigen::Matrix<float, 4, 4, Eigen::DontAlign> model;
+	Eigen::Matrix<float, 4, 4, Eigen::DontAlign> dequantize;
+};
+Transforms transforms;
+UniformBuffer transformBuffer;
+
+// Transforms of every gallery item, written to the uniform buffer together
+std::vector<Transforms> galleryTransforms;
+
+// GPU time per pass, printed with P and written as CSV on exit, see --gpu-profile
+GpuProfiler gpuProfiler;
+std::string gpuProfilePath;
+
+// CPU time of the main loop, the key callback and the importers, written
+// as a Chrome trace with T, see --trace
+std::string tracePath = "trace.json";
+
+// Render frames into an offscreen framebuffer instead of a window and
+// save the last one, see --headless, --frames and --output
+int headlessWidth = 0, headlessHeight = 0;
+unsigned int headlessFrames = 1;
+std::string outputPath;
+
+// Orbit the camera around one mesh over the headless frames and save every
+// one of them, encoded by the pool while the next is rendered. The sweep in
+// degrees and the height are the angle and height moved by the arrow keys.
+// See --turntable, --orbit, --output-dir and --format
+std::string turntablePath;
+float orbitSweep = 360, orbitHeight = 0;
+std::string outputDir = ".";
+ImageFormat imageFormat = IMAGE_PNG;
+
+// Record every frame, read back through a ring of pixel buffers and saved
+// in --format by the pool, see --capture
+std::string captureDir;
+FrameCapture frameCapture;
+
+// Print frame time and GPU memory use periodically, see --stats
+bool printStats = false;
+
+// Worker threads for parsing large meshes
+ThreadPool pool;
+
+// Imports OFF files in the background
+MeshLoader loader(&pool);
+
+// Imports the gallery meshes, one after the other, without cancelling the
+// scene's loads
+MeshLoader galleryLoader(&pool);
 
 // Contains the vertex positions
 Eigen::MatrixXf V(6, 0);
@@ -27,17 +167,35 @@ Eigen::MatrixXf V(6, 0);
 // Contains the camera location
 Eigen::Vector3f camPos(0, 0, 1);
 
-//void importBox(std::vector<unsigned int> & Index);
-void importBox(GLuint * E);
-void importBumpyCube(GLuint * E);
-void importBunny(GLuint * E);
+void showMesh(const std::string & path, const ImportSettings & settings);
+void showBox();
+ImportSettings sceneSettings(const ImportSettings & settings);
+void addToGallery(const std::string & path, const ImportSettings & settings);
+void cycleGallery();
+void updateGallery();
+void drawGallery(const Eigen::Matrix4f & model);
+void addMesh(const std::string & key, const PackedVertices & vertices, const GLuint * E, GLsizei count,
+	const std::vector<MeshLevel> & levels = std::vector<MeshLevel>(),
+	const std::vector<Meshlet> & meshlets = std::vector<Meshlet>());
+void showLoadProgress(GLFWwindow * window);
+void showFrameStats(double frameTime);
+void setCullFaces(bool enabled);
+bool showTurntable(const std::string & path);
+void showTurntableStats(unsigned int frames, double seconds, double render, double readback, const ImageWriter & writer);
+void orbitCamera(unsigned int frame);
+std::string turntableFramePath(unsigned int frame);
+void saveOutput(const std::vector<unsigned char> & rgb, int width, int height);
+int renderSoftware();
+Eigen::Matrix4f modelMatrix();
+Eigen::Matrix4f cameraMatrix(int width, int height);
+void placeInstances(unsigned int count);
 Eigen::Matrix4f scaleMatrix(const float & scale);
 Eigen::Matrix4f rotateMatrix(const float & angle, const char & axis);
 Eigen::Matrix4f translateMatrix(const float & shift, const char & axis);
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
-	GLuint E[3000];
+	TRACE_SCOPE("key_callback");
 	static float camXY = 0;
 	if (action != GLFW_RELEASE && mods == 0) {
 		switch (key)
@@ -68,10 +226,32 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 			camXY = 0;
 			break;
 		case  GLFW_KEY_Q:
-			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+			glState.polygonMode(GL_FILL);
 			break;
 		case  GLFW_KEY_W:
-			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+			glState.polygonMode(GL_LINE);
+			break;
+		case  GLFW_KEY_B:
+			cullFaces = !cullFaces;
+			setCullFaces(cullFaces);
+			printf("Back face culling %s\n", cullFaces ? "on" : "off");
+			break;
+		case  GLFW_KEY_C:
+			//Cycle the color functions, stored colors only if the format has them
+			colorMode = (colorMode + 1) % COLOR_MODES;
+			if (colorMode == COLOR_STORED && !vertexHasColor(vertexFormat))
+				colorMode = COLOR_SQUARED;
+			printf("Color: %s\n", colorModeNames[colorMode]);
+			break;
+		case  GLFW_KEY_P:
+			gpuProfiler.print(std::cout);
+			break;
+		case  GLFW_KEY_T:
+			writeChromeTrace(tracePath);
+			break;
+		case  GLFW_KEY_I:
+			instancing = !instancing && instanceCount > 0;
+			printf("Instancing %s\n", instancing ? "on" : "off");
 			break;
 		case  GLFW_KEY_3:
 			rotateMatrix(0, 'r');
@@ -79,8 +259,7 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 			translateMatrix(0, 'r');
 			camPos << 0, 0, 1;
 			camXY = 0;
-			importBunny(E);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(float)*3000, E, GL_STATIC_DRAW);
+			showMesh("../data/bunny.off", ImportSettings(8, Eigen::Vector3f(0, -1, 0)));
 			break;
 		case  GLFW_KEY_2:
 			rotateMatrix(0, 'r');
@@ -88,8 +267,21 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 			translateMatrix(0, 'r');
 			camPos << 0, 0, 1;
 			camXY = 0;
-			importBumpyCube(E);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(float)*3000, E, GL_STATIC_DRAW);
+			showMesh("../data/bumpy_cube.off", ImportSettings(0.2));
+			break;
+		case  GLFW_KEY_4:
+			rotateMatrix(0, 'r');
+			scaleMatrix(-1);
+			translateMatrix(0, 'r');
+			camPos << 0, 0, 1;
+			camXY = 0;
+			if (gallery.empty() && galleryQueue.empty()) {
+				addToGallery("../data/bunny.off", ImportSettings(8, Eigen::Vector3f(0, -1, 0)));
+				addToGallery("../data/bumpy_cube.off", ImportSettings(0.2));
+				addToGallery("../data/bunny.off", ImportSettings(8, Eigen::Vector3f(0, -1, 0)));
+				addToGallery("../data/bumpy_cube.off", ImportSettings(0.2));
+			}
+			showGallery = true;
 			break;
 		case  GLFW_KEY_1:
 			rotateMatrix(0, 'r');
@@ -97,8 +289,7 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 			translateMatrix(0, 'r');
 			camPos << 0, 0, 1;
 			camXY = 0;
-			importBox(E);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(float) * 36, E, GL_STATIC_DRAW);
+			showBox();
 			break;
 		case GLFW_KEY_KP_4:
 			rotateMatrix(10, 'y');
@@ -153,35 +344,148 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 			break;
 		}
 	}
-	// Upload the change to the GPU
-	VBO.update(V);
+	if (action != GLFW_RELEASE && mods == GLFW_MOD_SHIFT) {
+		switch (key)
+		{
+		case GLFW_KEY_4:
+			if (showGallery)
+				cycleGallery();
+			break;
+		default:
+			break;
+		}
+	}
 }
 
 void window_resize_callback(GLFWwindow * window, int w, int h) {
 	glViewport(0, 0, w, h);
 }
 
-int main(void)
+int main(int argc, char * argv[])
 {
-	GLFWwindow* window;
-	if (!glfwInit())
-		return -1;
-	glfwWindowHint(GLFW_SAMPLES, 8);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-
-	#ifdef __APPLE__
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-	#endif
+	//Optional GPU memory budget for resident meshes in MB, vertex format, mesh optimization, levels of detail, culling, instances, statistics, GL error reporting, GPU profile, trace, offscreen rendering, turntables and frame capture
+	setTraceThreadName("main");
+	GLDiagnostics diagnostics = glDiagnostics;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--gpu-budget") == 0 && i + 1 < argc)
+			registry.setBudget(size_t(atof(argv[++i]) * 1024 * 1024));
+		else if (strcmp(argv[i], "--vertex-format") == 0 && i + 1 < argc) {
+			if (!parseVertexFormat(argv[++i], vertexFormat))
+				fprintf(stderr, "Unknown vertex format %s, use float, compact, position or compact-position\n", argv[i]);
+		}
+		else if (strcmp(argv[i], "--optimize") == 0 && i + 1 < argc) {
+			if (!parseMeshOptimization(argv[++i], meshOptimization))
+				fprintf(stderr, "Unknown optimization %s, use none, cache or overdraw\n", argv[i]);
+		}
+		else if (strcmp(argv[i], "--lod") == 0 && i + 1 < argc)
+			lodLevels = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc)
+			lodThreshold = atof(argv[++i]);
+		else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+			instanceCount = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--no-meshlets") == 0)
+			meshletCulling = false;
+		else if (strcmp(argv[i], "--stats") == 0)
+			printStats = true;
+		else if (strcmp(argv[i], "--gl-debug") == 0 && i + 1 < argc) {
+			if (!parseGLDiagnostics(argv[++i], diagnostics))
+				fprintf(stderr, "Unknown GL diagnostics %s, use off, callback or sync\n", argv[i]);
+		}
+		else if (strcmp(argv[i], "--gpu-profile") == 0 && i + 1 < argc)
+			gpuProfilePath = argv[++i];
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+			tracePath = argv[++i];
+		else if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc) {
+			if (sscanf(argv[++i], "%dx%d", &headlessWidth, &headlessHeight) != 2 || headlessWidth <= 0 || headlessHeight <= 0) {
+				fprintf(stderr, "Invalid size %s, use WIDTHxHEIGHT\n", argv[i]);
+				return -1;
+			}
+		}
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			headlessFrames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+			outputPath = argv[++i];
+		else if (strcmp(argv[i], "--renderer") == 0 && i + 1 < argc) {
+			++i;
+			renderer = RENDERERS;
+			for (int r = 0; r < RENDERERS; ++r)
+				if (strcmp(argv[i], rendererNames[r]) == 0)
+					renderer = r;
+			if (renderer == RENDERERS) {
+				fprintf(stderr, "Unknown renderer %s, use gl, software or raytrace\n", argv[i]);
+				return -1;
+			}
+		}
+		else if (strcmp(argv[i], "--wireframe") == 0)
+			wireframe = true;
+		else if (strcmp(argv[i], "--cull-faces") == 0)
+			cullFaces = true;
+		else if (strcmp(argv[i], "--shadows") == 0)
+			shadows = true;
+		else if (strcmp(argv[i], "--ao") == 0 && i + 1 < argc) {
+			int samples;
+			if (sscanf(argv[++i], "%d", &samples) != 1 || samples <= 0) {
+				fprintf(stderr, "Invalid ambient occlusion samples %s, use a count above 0\n", argv[i]);
+				return -1;
+			}
+			aoSamples = samples;
+		}
+		else if (strcmp(argv[i], "--turntable") == 0 && i + 1 < argc)
+			turntablePath = argv[++i];
+		else if (strcmp(argv[i], "--orbit") == 0 && i + 1 < argc) {
+			if (sscanf(argv[++i], "%f,%f", &orbitSweep, &orbitHeight) != 2 || orbitHeight < -1 || orbitHeight > 1) {
+				fprintf(stderr, "Invalid orbit %s, use DEGREES,HEIGHT with a height from -1 to 1\n", argv[i]);
+				return -1;
+			}
+		}
+		else if (strcmp(argv[i], "--output-dir") == 0 && i + 1 < argc)
+			outputDir = argv[++i];
+		else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+			captureDir = argv[++i];
+		else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+			if (!parseImageFormat(argv[++i], imageFormat))
+				fprintf(stderr, "Unknown image format %s, use ppm, png or qoi\n", argv[i]);
+		}
+	}
 
-	window = glfwCreateWindow(640, 480, "Hello World", NULL, NULL);
-	if (!window)
-	{
-		glfwTerminate();
-		return -1;
+	//Turntables and the software renderers are always drawn offscreen
+	if ((!turntablePath.empty() || renderer != RENDERER_GL) && headlessWidth == 0) {
+		headlessWidth = 640;
+		headlessHeight = 480;
+	}
+	if (renderer != RENDERER_GL)
+		return renderSoftware();
+
+	//Without a window everything is drawn into a framebuffer object
+	GLFWwindow* window = NULL;
+	HeadlessContext headless;
+	FrameBufferObject offscreen;
+	if (headlessWidth > 0) {
+		if (!headless.init())
+			return -1;
+		printf("Rendering headless at %dx%d with %s\n", headlessWidth, headlessHeight, HeadlessContext::backend());
+	}
+	else {
+		if (!glfwInit())
+			return -1;
+		glfwWindowHint(GLFW_SAMPLES, 8);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+		glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, diagnostics == DIAGNOSTICS_CALLBACK);
+
+		#ifdef __APPLE__
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+		#endif
+
+		window = glfwCreateWindow(640, 480, "Hello World", NULL, NULL);
+		if (!window)
+		{
+			glfwTerminate();
+			return -1;
+		}
+		glfwMakeContextCurrent(window);
 	}
-	glfwMakeContextCurrent(window);
 
 	#ifndef __APPLE__
 	glewExperimental = true;
@@ -195,38 +499,49 @@ int main(void)
 	fprintf(stdout, "Status: Using GLEW %s\n", glewGetString(GLEW_VERSION));
 	#endif
 
-	int major, minor, rev;
-	major = glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MAJOR);
-	minor = glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MINOR);
-	rev = glfwGetWindowAttrib(window, GLFW_CONTEXT_REVISION);
-	printf("OpenGL version recieved: %d.%d.%d\n", major, minor, rev);
+	if (window) {
+		int major, minor, rev;
+		major = glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MAJOR);
+		minor = glfwGetWindowAttrib(window, GLFW_CONTEXT_VERSION_MINOR);
+		rev = glfwGetWindowAttrib(window, GLFW_CONTEXT_REVISION);
+		printf("OpenGL version recieved: %d.%d.%d\n", major, minor, rev);
+	}
 	printf("Supported OpenGL is %s\n", (const char*)glGetString(GL_VERSION));
 	printf("Supported GLSL is %s\n", (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION));
-
-	VertexArrayObject VAO;
-	VAO.init();
-	VAO.bind();
-
-	VBO.init();
-	GLuint ebo;
-	glGenBuffers(1, &ebo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	GLuint E[3000];
-	importBox(E);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(E), E, GL_STATIC_DRAW);
+	setGLDiagnostics(diagnostics);
+	printf("GL diagnostics: %s\n", glDiagnosticsName(glDiagnostics));
+	if (!window) {
+		if (!offscreen.init(headlessWidth, headlessHeight))
+			return -1;
+		offscreen.bind();
+	}
 
 	Program program;
 	const GLchar* vertex_shader =
 		"#version 150 core\n"
 		"in vec3 position;"
 		"in vec3 color;"
-		"uniform mat4 model;"
-		"uniform mat4 projection;"
+		"in mat4 instance;" //Per instance transform, identity when not instancing
+		"layout(std140) uniform Transforms"
+		"{"
+		"    mat4 projection;"
+		"    mat4 model;"
+		"    mat4 dequantize;" //Decodes quantized positions, identity for floats
+		"};"
+		"uniform int colorMode;"
 		"out vec3 Color;"
+		"vec3 procedural(vec3 p)"
+		"{"
+		"    if (colorMode == 1) return p * p;"
+		"    if (colorMode == 2) return mix(vec3(0.1, 0.2, 0.6), vec3(0.9, 0.8, 0.3), clamp(0.5 + 0.5 * p.y, 0.0, 1.0));"
+		"    if (colorMode == 3) return abs(p) / max(length(p), 1e-6);"
+		"    return color;"
+		"}"
 		"void main()"
 		"{"
-		"	 Color = color;"
-		"    gl_Position = projection * model * vec4(position, 1.0);"
+		"    vec4 p = dequantize * vec4(position, 1.0);"
+		"	 Color = procedural(p.xyz);"
+		"    gl_Position = projection * model * instance * p;"
 		"}";
 	const GLchar* fragment_shader =
 		"#version 150 core\n"
@@ -239,155 +554,382 @@ int main(void)
 
 	program.init(vertex_shader, fragment_shader, "outColor");
 	program.bind();
+	transformBuffer.init(sizeof(Transforms), 0);
+	gpuProfiler.init();
+	program.bindUniformBlock("Transforms", transformBuffer.binding);
+
+	//Formats without colors start with the original squared position coloring
+	if (!vertexHasColor(vertexFormat))
+		colorMode = COLOR_SQUARED;
+
+	if (instanceCount > 0) {
+		instances.init();
+		placeInstances(instanceCount);
+		instancing = true;
+	}
 
-	GLint posAttrib = glGetAttribLocation(program.program_shader, "position");
-	glEnableVertexAttribArray(posAttrib);
-	glVertexAttribPointer(posAttrib, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), 0);
-	GLint colAttrib = glGetAttribLocation(program.program_shader, "color");
-	glEnableVertexAttribArray(colAttrib);
-	glVertexAttribPointer(colAttrib, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+	registry.setupAttributes = [&program](VertexFormat format) {
+		setupVertexAttributes(program, format);
+	};
+	arena.setupAttributes = registry.setupAttributes;
+	arena.init(vertexFormat);
+	showBox();
+	if (!turntablePath.empty() && !showTurntable(turntablePath))
+		return -1;
+	//Set explicitly so the tracker knows filled polygons may be culled
+	glState.polygonMode(wireframe ? GL_LINE : GL_FILL);
+	setCullFaces(cullFaces);
+
+	if (window) {
+		glfwSetKeyCallback(window, key_callback);
+		glfwSetWindowSizeCallback(window, window_resize_callback);
+	}
 
-	glfwSetKeyCallback(window, key_callback);
-	glfwSetWindowSizeCallback(window, window_resize_callback);
+	//Finished turntable frames are encoded by the pool, render and readback times are summed here
+	std::unique_ptr<ImageWriter> turntable;
+	if (!turntablePath.empty())
+		turntable.reset(new ImageWriter(&pool));
+	double renderTime = 0, readbackTime = 0;
+
+	//Captured frames are converted while mapped and queued for the pool, with room for a few slow frames
+	std::unique_ptr<ImageWriter> recorder;
+	if (!captureDir.empty()) {
+		recorder.reset(new ImageWriter(&pool, 16));
+		frameCapture.consumer = [&recorder](const CapturedFrame & captured) {
+			std::vector<unsigned char> rgb;
+			captured.copyRGB(rgb);
+			char name[32];
+			snprintf(name, sizeof(name), "/frame%05u.%s", captured.frame, imageFormatName(imageFormat));
+			recorder->write(captureDir + name, rgb, captured.width, captured.height, imageFormat);
+		};
+		frameCapture.init();
+	}
 
-	while (!glfwWindowShouldClose(window))
+	unsigned int frame = 0;
+	double lastFrame = traceNow() * 1e-9;
+	double firstFrame = lastFrame;
+	while (window ? !glfwWindowShouldClose(window) : frame < headlessFrames)
 	{
+		TRACE_SCOPE("frame");
+		gpuProfiler.beginFrame();
+		if (turntable)
+			orbitCamera(frame);
+
+		//Upload a mesh finished by the loader and switch to it at the frame boundary
+		std::unique_ptr<MeshData> mesh = loader.poll();
+		if (mesh) {
+			TRACE_SCOPE("upload");
+			GpuScope upload(gpuProfiler, "upload");
+			addMesh(mesh->path, mesh->packed, mesh->indices, mesh->count, mesh->levels, mesh->meshlets);
+		}
+		updateGallery();
+		if (window)
+			showLoadProgress(window);
+
 		program.bind();
 
-		//Translate
-		Eigen::Matrix4f translate = translateMatrix(0, 'x');
+		TraceScope cameraScope("transforms");
+		Eigen::Matrix4f model = modelMatrix();
+		transforms.model = model;
+		transforms.dequantize = current->dequantize;
+		glUniform1i(program.uniform("colorMode"), colorMode);
 
-		//Rotate
-		Eigen::Matrix4f rotate = rotateMatrix(0, 'x');
+		//Viewport
+		int width = offscreen.width, height = offscreen.height;
+		if (window)
+			glfwGetWindowSize(window, &width, &height);
+		Eigen::Matrix4f projection = cameraMatrix(width, height);
+		transforms.projection = projection;
+		cameraScope.end();
+
+		TraceScope uniformScope("uniform upload");
+		transformBuffer.update(transforms);
+		uniformScope.end();
+
+		//Level of detail from the size of the mesh on screen, instances are scaled down
+		Eigen::Matrix4f lodTransform = projection * model;
+		if (instancing)
+			lodTransform.leftCols(3) *= instanceScale;
+		current->selectLevel(lodTransform, width, height, lodThreshold);
+
+		TraceScope drawScope("draw submission");
+		glState.enable(GL_DEPTH_TEST);
+		gpuProfiler.begin("clear");
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		gpuProfiler.end();
+
+		//Meshlets outside the view are skipped, and those facing away when GL culls back faces. Instances are drawn whole
+		GLint instanceAttrib = program.attrib("instance");
+		gpuProfiler.begin("draw");
+		if (showGallery) {
+			setIdentityInstance(instanceAttrib);
+			drawGallery(model);
+		}
+		else if (instancing) {
+			instances.upload();
+			current->drawInstanced(instances, instanceAttrib);
+		}
+		else {
+			setIdentityInstance(instanceAttrib);
+			bool backfaces = glState.isEnabled(GL_CULL_FACE) && glState.currentPolygonMode() == GL_FILL;
+			current->draw(projection * model, backfaces, cullStats);
+		}
+		gpuProfiler.end();
+		transformBuffer.fence();
+		drawScope.end();
+
+		gpuProfiler.endFrame();
+		if (recorder) {
+			int captureWidth = offscreen.width, captureHeight = offscreen.height;
+			if (window)
+				glfwGetFramebufferSize(window, &captureWidth, &captureHeight);
+			frameCapture.capture(window ? 0 : offscreen.id, captureWidth, captureHeight);
+		}
+		if (turntable) {
+			//Wait for the GPU so that the readback is timed on its own
+			glFinish();
+			double rendered = traceNow() * 1e-9;
+			renderTime += rendered - lastFrame;
+
+			std::vector<unsigned char> rgb;
+			{
+				TRACE_SCOPE("readback");
+				offscreen.read(rgb);
+			}
+			readbackTime += traceNow() * 1e-9 - rendered;
+
+			turntable->write(turntableFramePath(frame), rgb, offscreen.width, offscreen.height, imageFormat);
+		}
+		if (window) {
+			{
+				TRACE_SCOPE("swap");
+				glfwSwapBuffers(window);
+			}
+			{
+				TRACE_SCOPE("poll events");
+				glfwPollEvents();
+			}
+		}
+		++frame;
 
-		//Scale
-		Eigen::Matrix4f scale = scaleMatrix(0);
+		double now = traceNow() * 1e-9;
+		showFrameStats(now - lastFrame);
+		lastFrame = now;
+	}
 
-		//Combine transformations
-		Eigen::Matrix4f model = translate * rotate * scale;
+	if (recorder) {
+		frameCapture.free();
+		recorder->wait();
+		printf("Captured %u frames into %s, %u waited for the GPU, %u could not be written\n",
+			frameCapture.delivered, captureDir.c_str(), frameCapture.stalls, recorder->failed());
+	}
+	if (turntable) {
+		turntable->wait();
+		showTurntableStats(frame, traceNow() * 1e-9 - firstFrame, renderTime, readbackTime, *turntable);
+	}
 
-		glUniformMatrix4fv(program.uniform("model"), 1, GL_FALSE, model.data());
+	//Save the last frame rendered offscreen
+	if (!window && !outputPath.empty()) {
+		std::vector<unsigned char> rgb;
+		offscreen.read(rgb);
+		saveOutput(rgb, offscreen.width, offscreen.height);
+	}
 
-		//Viewport
-		int width, height;
-		glfwGetWindowSize(window, &width, &height);
-		float aspect_ratio = float(height) / float(width);
-		Eigen::Matrix4f view;
-		view <<
-			aspect_ratio, 0, 0, 0,
-			0, 1, 0, 0,
-			0, 0, 1, 0,
-			0, 0, 0, 1;
-
-		//Orth
-		float l = -1, b = -1, n = 0.1;
-		float r = 1, t = 1, f = -1000;
-		Eigen::Matrix4f orth;
-		orth <<
-			2.0/(r-l), 0, 0, -1*(r+l)/(r-l),
-			0, 2.0/(t-b), 0, -1*(t+b)/(t-b),
-			0, 0, 2.0/(n-f), -1*(n+f)/(n-f),
-			0, 0, 0, 1;
-
-		//Camera
-		Eigen::Vector3f target(0, 0, 0);
-		Eigen::Vector3f g = target - camPos;
-		Eigen::Vector3f w = -g / g.norm();
-		Eigen::Vector3f up(0, 1, 0);
-		Eigen::Vector3f u = up.cross(w) / (up.cross(w)).norm();
-		Eigen::Vector3f v = w.cross(u);
-		Eigen::Matrix4f cam;
-		cam <<
-		u[0], v[0], w[0], camPos[0],
-		u[1], v[1], w[1], camPos[1],
-		u[2], v[2], w[2], camPos[2],
-		0, 0, 0, 1;
+	program.free();
+	transformBuffer.free();
+	registry.clear();
+	arena.free();
+	if (instanceCount > 0)
+		instances.free();
+	if (!gpuProfilePath.empty())
+		gpuProfiler.writeCSV(gpuProfilePath);
+	gpuProfiler.free();
+	reportGLDiagnostics();
+	if (window)
+		glfwTerminate();
+	else {
+		offscreen.free();
+		headless.free();
+	}
+	return 0;
+}
 
-		Eigen::Matrix4f projection;
-		projection = view * orth * cam.inverse();
-		
-		glUniformMatrix4fv(program.uniform("projection"), 1, GL_FALSE, projection.data());
+ImportSettings sceneSettings(const ImportSettings & settings) {
+	//Placement from the caller, everything else from the command line
+	ImportSettings withFormat = settings;
+	withFormat.format = vertexFormat;
+	withFormat.optimization = meshOptimization;
+	withFormat.levels = lodLevels;
+	withFormat.meshlets = meshletCulling;
+	return withFormat;
+}
 
-		glEnable(GL_DEPTH_TEST);
-		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+void showMesh(const std::string & path, const ImportSettings & settings) {
+	//Resident meshes are switched to at once, others are loaded in the background
+	showGallery = false;
+	GpuMesh * mesh = registry.find(path);
+	if (mesh) {
+		loader.cancel();
+		current = mesh;
+	}
+	else
+		loader.request(path, sceneSettings(settings));
+}
+
+void addToGallery(const std::string & path, const ImportSettings & settings) {
+	//Queued for the gallery loader, updateGallery uploads it once imported
+	GalleryItem item = { path, settings, -1 };
+	galleryQueue.push_back(item);
+}
 
-		glDrawElements(GL_TRIANGLES, sizeof(E) / 4, GL_UNSIGNED_INT, 0);
+void cycleGallery() {
+	//Move the first mesh to the end, its range stays resident in the arena
+	if (gallery.empty())
+		return;
+	gallery.push_back(gallery.front());
+	gallery.pop_front();
+}
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+void updateGallery() {
+	//Upload the mesh finished by the gallery loader and start importing the next one
+	if (galleryLoading) {
+		if (galleryLoader.busy())
+			return;
+		GalleryItem item = galleryQueue.front();
+		galleryQueue.pop_front();
+		galleryLoading = false;
+		std::unique_ptr<MeshData> mesh = galleryLoader.poll();
+		if (mesh) {
+			TRACE_SCOPE("gallery upload");
+			GLsizei count = mesh->levels.empty() ? mesh->count : mesh->levels[0].count;
+			item.handle = arena.add(mesh->packed, mesh->indices, count);
+			if (item.handle >= 0) {
+				gallery.push_back(item);
+				printf("Gallery: %u meshes, %.1f KB used of %.1f KB in the arena\n", (unsigned) gallery.size(),
+					arena.usedBytes() / 1024.0, arena.capacityBytes() / 1024.0);
+			}
+		}
+	}
+	if (!galleryQueue.empty()) {
+		galleryLoader.request(galleryQueue.front().path, sceneSettings(galleryQueue.front().settings));
+		galleryLoading = true;
 	}
+}
 
-	program.free();
-	VAO.free();
-	VBO.free();
-	glfwTerminate();
-	return 0;
+void drawGallery(const Eigen::Matrix4f & model) {
+	//One VAO for all meshes. The transforms of all items are written once, each draw binds its range.
+	if (gallery.empty())
+		return;
+	arena.bind();
+	float width = 2.0f / gallery.size();
+	galleryTransforms.assign(gallery.size(), transforms);
+	for (size_t i = 0; i < gallery.size(); ++i) {
+		Eigen::Affine3f place = Eigen::Translation3f(-1 + width * (i + 0.5f), 0, 0) * Eigen::Scaling(width * 0.45f);
+		galleryTransforms[i].model = model * place.matrix();
+		galleryTransforms[i].dequantize = arena.mesh(gallery[i].handle).dequantize;
+	}
+	size_t first = transformBuffer.write(galleryTransforms.data(), galleryTransforms.size(), sizeof(Transforms));
+	for (size_t i = 0; i < gallery.size(); ++i) {
+		transformBuffer.bind(first + i * transformBuffer.alignedSize());
+		arena.draw(gallery[i].handle);
+	}
 }
 
-void importBunny(GLuint * E) {
-	//Clear V matrix
-	V.resize(6,0);
-
-	//Declarations
-	Eigen::Vector3f vertices;
-	Eigen::Vector4f faces;
-	std::string line;
-	std::ifstream inputfile;
-	int num_of_vertices;
-	int num_of_faces;
-
-	//Open file
-	inputfile.open("../data/bunny.off");
-
-	//First line is useless
-	getline(inputfile, line);
-
-	//Second line has number of vertices and faces
-	getline(inputfile, line);
-	std::stringstream sstream(line);
-	sstream >> num_of_vertices;
-	sstream >> num_of_faces;
-
-	//Add columns for new vertices
-	V.conservativeResize(V.rows(), V.cols() + num_of_vertices);
-
-	//Read in vertices line by line and put in V matrix
-	for (int v = 0; v < num_of_vertices; ++v) {
-		getline(inputfile, line);
-		std::stringstream sstream(line);
-		sstream >> vertices[0];
-		sstream >> vertices[1];
-		sstream >> vertices[2];
-		vertices = vertices * 8; //Scale up 8x
-		vertices[1]--;			 //Translate down 1
-		V.col(v) << 
-			vertices[0],			//X
-			vertices[1],			//Y
-			vertices[2],			//Z
-			pow(vertices[0], 2),	//R
-			pow(vertices[1], 2),	//G
-			pow(vertices[2], 2);	//B
-	}
-
-	VBO.update(V);
-
-	for (int camPos = 0; camPos < num_of_faces; ++camPos) {
-		getline(inputfile, line);
-		std::stringstream sstream(line);
-		sstream >> faces[0]; //Useless first number
-		sstream >> faces[1]; //Triangle point 1
-		sstream >> faces[2]; //Triangle point 2
-		sstream >> faces[3]; //Triangle point 3
-
-		E[camPos * 3] = faces[1];		//Fill E with indices that will be put 
-		E[(camPos * 3) + 1] = faces[2];	//into the element buffer
-		E[(camPos * 3) + 2] = faces[3];
-	}
-	inputfile.close();
+void addMesh(const std::string & key, const PackedVertices & vertices, const GLuint * E, GLsizei count,
+	const std::vector<MeshLevel> & levels, const std::vector<Meshlet> & meshlets) {
+	//The software renderers draw the full level of detail, nothing is uploaded
+	if (renderer != RENDERER_GL) {
+		GLsizei full = levels.empty() ? count : levels[0].count;
+		softwareMesh.init(vertices, E + (levels.empty() ? 0 : levels[0].first), full);
+		printf("Decoded %s: %u vertices, %u triangles\n", key.c_str(), vertices.count, (unsigned) full / 3);
+		return;
+	}
+	current = registry.add(key, vertices, E, count, levels, meshlets);
+
+	//Report the memory of the chosen vertex format against plain floats
+	printf("Uploaded %s: %u vertices, %s format %u bytes/vertex, %.1f KB on the GPU (%.1f KB as floats)\n",
+		key.c_str(), vertices.count, vertexFormatName(vertices.format), (unsigned) vertexSize(vertices.format),
+		current->bytes / 1024.0, (current->bytes - vertices.size + vertices.count * vertexSize(VERTEX_FLOAT)) / 1024.0);
 }
 
-void importBox(GLuint * E) {
+void showLoadProgress(GLFWwindow * window) {
+	//Show the progress of a background load in the title bar
+	static bool loading = false;
+	if (loader.busy()) {
+		std::stringstream title;
+		title << "Hello World - Loading " << int(loader.progress() * 100) << "%";
+		glfwSetWindowTitle(window, title.str().c_str());
+		loading = true;
+	}
+	else if (loading) {
+		glfwSetWindowTitle(window, "Hello World");
+		loading = false;
+	}
+}
+
+void setCullFaces(bool enabled) {
+	//The meshes wind their outside counter-clockwise, the camera matrix keeps the z axis of the view
+	//and so mirrors them to clockwise in the window
+	glFrontFace(GL_CW);
+	glCullFace(GL_BACK);
+	if (enabled)
+		glState.enable(GL_CULL_FACE);
+	else
+		glState.disable(GL_CULL_FACE);
+}
+
+void showFrameStats(double frameTime) {
+	//Average frame time, GPU memory in use, level of detail, meshlet culling and redundant state changes, printed every
+	//two seconds
+	static double total = 0;
+	static int frames = 0;
+	if (!printStats)
+		return;
+	total += frameTime;
+	++frames;
+	if (total >= 2) {
+		printf("Frame %.3f ms, %s vertices, %.1f KB of meshes on the GPU\n",
+			1000 * total / frames, vertexFormatName(vertexFormat), registry.used() / 1024.0);
+		if (current && !current->levels.empty())
+			printf("Drawing level %u of %s: %u triangles\n", current->level, current->key.c_str(),
+				current->levels[current->level].count / 3);
+		if (cullStats.meshlets > 0)
+			printf("Culled %.1f%% of meshlets (%.1f%% frustum, %.1f%% backface), %.1f%% of triangles\n",
+				100.0 * (cullStats.frustumCulled + cullStats.backfaceCulled) / cullStats.meshlets,
+				100.0 * cullStats.frustumCulled / cullStats.meshlets, 100.0 * cullStats.backfaceCulled / cullStats.meshlets,
+				100.0 * (cullStats.triangles - cullStats.trianglesDrawn) / cullStats.triangles);
+		printf("Skipped %.1f of %.1f state changes per frame\n",
+			(double) glState.skipped / frames, (double) glState.calls / frames);
+		cullStats.reset();
+		glState.resetCounts();
+		total = 0;
+		frames = 0;
+	}
+}
+
+void placeInstances(unsigned int count) {
+	//Fill a cube of side 2 with a grid of scaled down, turned copies
+	int side = int(std::ceil(std::cbrt(double(count))));
+	instanceScale = 1.0f / side;
+	std::vector<InstanceBuffer::Transform> transforms(count);
+	for (unsigned int i = 0; i < count; ++i) {
+		Eigen::Vector3f cell(float(i % side), float(i / side % side), float(i / (side * side)));
+		Eigen::Affine3f t = Eigen::Translation3f((cell * 2 + Eigen::Vector3f::Ones()) * instanceScale - Eigen::Vector3f::Ones())
+			* Eigen::AngleAxisf(0.7f * i, Eigen::Vector3f::UnitY()) * Eigen::Scaling(instanceScale);
+		transforms[i] = t.matrix();
+	}
+	instances.clear();
+	instances.add(transforms.data(), transforms.size());
+	printf("Placed %u instances\n", count);
+}
+
+void showBox() {
+	showGallery = false;
+	loader.cancel();
+	current = registry.find("box");
+	if (current)
+		return;
 
 	//Manual input of Box vertex positions and colors
 	V.resize(6, 8);
@@ -401,8 +943,7 @@ void importBox(GLuint * E) {
 	V.col(7) << 0.5, -0.5, 0.5, 0.2, 0.2, 0.2;
 
 	//Manual input of Box indices
-	Eigen::VectorXf elements(36);
-	elements <<
+	GLuint E[36] = {
 		0, 1, 3,
 		3, 2, 0,
 		1, 5, 7,
@@ -414,74 +955,11 @@ void importBox(GLuint * E) {
 		0, 4, 5,
 		5, 1, 0,
 		2, 3, 7,
-		7, 6, 2;
-
-	//Fill E with indices for the element buffer
-	for (int i = 0; i < 36; ++i) {
-		E[i] = elements[i];
-	}
-	VBO.update(V);
-}
+		7, 6, 2 };
 
-void importBumpyCube(GLuint * E) {
-	//Clear V matrix
-	V.resize(6, 0);
-
-	//Declarations
-	Eigen::Vector3f vertices;
-	Eigen::Vector4f faces;
-	std::string line;
-	std::ifstream inputfile;
-	int num_of_vertices;
-	int num_of_faces;
-
-	//Open file
-	inputfile.open("../data/bumpy_cube.off");
-
-	//First line is useless
-	getline(inputfile, line);
-
-	//Second line has number of vertices and faces
-	getline(inputfile, line);
-	std::stringstream sstream(line);
-	sstream >> num_of_vertices;
-	sstream >> num_of_faces;
-
-	//Add columns for new vertices
-	V.conservativeResize(V.rows(), V.cols() + num_of_vertices);
-
-	//Read in vertices line by line and put in V matrix
-	for (int v = 0; v < num_of_vertices; ++v) {
-		getline(inputfile, line);
-		std::stringstream sstream(line);
-		sstream >> vertices[0];
-		sstream >> vertices[1];
-		sstream >> vertices[2];
-		vertices = vertices * 0.2; //Scale down to 20%
-		V.col(v) << 
-			vertices[0],			//X
-			vertices[1],			//Y
-			vertices[2],			//Z
-			pow(vertices[0], 2),	//R
-			pow(vertices[1], 2),	//G
-			pow(vertices[2], 2);	//B
-	}
-
-	VBO.update(V);
-
-	for (int camPos = 0; camPos < num_of_faces; ++camPos) {
-		getline(inputfile, line);
-		std::stringstream sstream(line);
-		sstream >> faces[0]; //Useless first number
-		sstream >> faces[1]; //Triangle point 1
-		sstream >> faces[2]; //Triangle point 2
-		sstream >> faces[3]; //Triangle point 3
-
-		E[camPos * 3] = faces[1];		//Fill E with indices that will be put 
-		E[(camPos * 3) + 1] = faces[2];	//into the element buffer
-		E[(camPos * 3) + 2] = faces[3];
-	}
-	inputfile.close();
+	PackedVertices packed;
+	packVertices(V.data(), V.rows(), V.cols(), vertexFormat, packed);
+	addMesh("box", packed, E, 36);
 }
 
 Eigen::Matrix4f rotateMatrix(const float & angle, const char & axis) {
@@ -571,4 +1049,197 @@ Eigen::Matrix4f translateMatrix(const float & shift, const char & axis) {
 		0, 0, 0, 1;
 
 	return T;
+}
+
+bool showTurntable(const std::string & path) {
+	//Imported on the spot, then scaled and centered so that it fills the view from every side
+	MeshData mesh;
+	if (!importMesh(path, sceneSettings(ImportSettings()), mesh, &pool))
+		return false;
+	addMesh(mesh.path, mesh.packed, mesh.indices, mesh.count, mesh.levels, mesh.meshlets);
+
+	Eigen::Map<const Eigen::MatrixXf> vertices(mesh.vertices, mesh.rows, mesh.cols);
+	Eigen::Vector3f lower = vertices.topRows(3).rowwise().minCoeff();
+	Eigen::Vector3f upper = vertices.topRows(3).rowwise().maxCoeff();
+	Eigen::Vector3f center = (lower + upper) / 2;
+	float radius = (upper - lower).norm() / 2;
+	float scale = radius > 0 ? 0.9 / radius : 1;
+	scaleMatrix(scale - 1);
+	translateMatrix(-scale * center[0], 'x');
+	translateMatrix(-scale * center[1], 'y');
+	translateMatrix(-scale * center[2], 'z');
+	printf("Turntable of %s: %u frames over %.0f degrees at height %.2f into %s/*.%s\n", path.c_str(),
+		headlessFrames, orbitSweep, orbitHeight, outputDir.c_str(), imageFormatName(imageFormat));
+	return true;
+}
+
+void showTurntableStats(unsigned int frames, double seconds, double render, double readback, const ImageWriter & writer) {
+	//Encoding overlaps rendering, its time is summed over the workers
+	if (frames == 0)
+		return;
+	printf("Turntable: %u frames in %.2f s, %.1f fps end to end\n", frames, seconds, frames / seconds);
+	printf("Per frame: render %.2f ms, readback %.2f ms, encode %.2f ms summed over %u pool threads, waited %.2f ms for the encoders\n",
+		1000 * render / frames, 1000 * readback / frames, 1000 * writer.encodeSeconds() / frames, pool.size(),
+		1000 * writer.blockedSeconds() / frames);
+	if (writer.failed() > 0)
+		printf("%u of %u frames could not be written\n", writer.failed(), frames);
+}
+
+Eigen::Matrix4f modelMatrix() {
+	//Translate
+	Eigen::Matrix4f translate = translateMatrix(0, 'x');
+
+	//Rotate
+	Eigen::Matrix4f rotate = rotateMatrix(0, 'x');
+
+	//Scale
+	Eigen::Matrix4f scale = scaleMatrix(0);
+
+	//Combine transformations
+	return translate * rotate * scale;
+}
+
+Eigen::Matrix4f cameraMatrix(int width, int height) {
+	//Projection of the camera at camPos looking at the origin, for a viewport of width x height
+	float aspect_ratio = float(height) / float(width);
+	Eigen::Matrix4f view;
+	view <<
+		aspect_ratio, 0, 0, 0,
+		0, 1, 0, 0,
+		0, 0, 1, 0,
+		0, 0, 0, 1;
+
+	//Orth
+	float l = -1, b = -1, n = 0.1;
+	float r = 1, t = 1, f = -1000;
+	Eigen::Matrix4f orth;
+	orth <<
+		2.0/(r-l), 0, 0, -1*(r+l)/(r-l),
+		0, 2.0/(t-b), 0, -1*(t+b)/(t-b),
+		0, 0, 2.0/(n-f), -1*(n+f)/(n-f),
+		0, 0, 0, 1;
+
+	//Camera
+	Eigen::Vector3f target(0, 0, 0);
+	Eigen::Vector3f g = target - camPos;
+	Eigen::Vector3f w = -g / g.norm();
+	Eigen::Vector3f up(0, 1, 0);
+	Eigen::Vector3f u = up.cross(w) / (up.cross(w)).norm();
+	Eigen::Vector3f v = w.cross(u);
+	Eigen::Matrix4f cam;
+	cam <<
+	u[0], v[0], w[0], camPos[0],
+	u[1], v[1], w[1], camPos[1],
+	u[2], v[2], w[2], camPos[2],
+	0, 0, 0, 1;
+
+	return view * orth * cam.inverse();
+}
+
+void orbitCamera(unsigned int frame) {
+	//The angle and height moved by the arrow keys, swept over the frames
+	float camXY = orbitSweep * 3.141592 / 180 * frame / headlessFrames;
+	camPos << sin(camXY), orbitHeight, cos(camXY);
+}
+
+std::string turntableFramePath(unsigned int frame) {
+	char name[32];
+	snprintf(name, sizeof(name), "/frame%04u.%s", frame, imageFormatName(imageFormat));
+	return outputDir + name;
+}
+
+void saveOutput(const std::vector<unsigned char> & rgb, int width, int height) {
+	//PPM unless the extension names another format
+	ImageFormat format = IMAGE_PPM;
+	size_t dot = outputPath.rfind('.');
+	if (dot != std::string::npos)
+		parseImageFormat(outputPath.substr(dot + 1), format);
+	if (writeImage(outputPath, rgb, width, height, format))
+		printf("Wrote %s\n", outputPath.c_str());
+}
+
+int renderSoftware() {
+	//The single mesh drawn with the shaders' pipeline on the pool, without a GL context,
+	//rasterized or ray traced. Only the selected renderer is created.
+	std::unique_ptr<SoftwareRasterizer> rasterizer;
+	std::unique_ptr<RayTracer> raytracer;
+	if (!vertexHasColor(vertexFormat))
+		colorMode = COLOR_SQUARED;
+	if (renderer == RENDERER_RAYTRACE) {
+		raytracer.reset(new RayTracer(&pool));
+		raytracer->resize(headlessWidth, headlessHeight);
+		raytracer->shadows = shadows;
+		raytracer->aoSamples = aoSamples;
+		raytracer->colorMode = colorMode;
+	}
+	else {
+		rasterizer.reset(new SoftwareRasterizer(&pool));
+		rasterizer->resize(headlessWidth, headlessHeight);
+		rasterizer->wireframe = wireframe;
+		rasterizer->colorMode = colorMode;
+	}
+	printf("Rendering in software at %dx%d on %u threads\n", headlessWidth, headlessHeight, pool.size());
+	if (!captureDir.empty())
+		printf("Frame capture needs the GL renderer, use --turntable to save every frame\n");
+	if (raytracer && wireframe)
+		printf("The ray tracer draws filled triangles only, ignoring --wireframe\n");
+	if (rasterizer && (shadows || aoSamples > 0))
+		printf("Shadows and ambient occlusion need --renderer raytrace\n");
+
+	showBox();
+	if (!turntablePath.empty() && !showTurntable(turntablePath))
+		return -1;
+	if (raytracer) {
+		raytracer->build(softwareMesh);
+		printf("Built the ray tracing hierarchy in %.2f ms\n", 1000 * raytracer->buildSeconds);
+	}
+	std::unique_ptr<ImageWriter> turntable;
+	if (!turntablePath.empty())
+		turntable.reset(new ImageWriter(&pool));
+
+	std::vector<unsigned char> rgb;
+	double renderTime = 0;
+	double firstFrame = traceNow() * 1e-9;
+	for (unsigned int frame = 0; frame < headlessFrames; ++frame) {
+		TRACE_SCOPE("frame");
+		double frameStart = traceNow() * 1e-9;
+		if (turntable)
+			orbitCamera(frame);
+		if (raytracer)
+			raytracer->render(cameraMatrix(headlessWidth, headlessHeight), modelMatrix());
+		else {
+			rasterizer->clear();
+			rasterizer->draw(softwareMesh, cameraMatrix(headlessWidth, headlessHeight) * modelMatrix());
+		}
+		renderTime += traceNow() * 1e-9 - frameStart;
+		if (turntable) {
+			if (raytracer)
+				raytracer->read(rgb);
+			else
+				rasterizer->read(rgb);
+			turntable->write(turntableFramePath(frame), rgb, headlessWidth, headlessHeight, imageFormat);
+		}
+	}
+
+	if (turntable) {
+		turntable->wait();
+		showTurntableStats(headlessFrames, traceNow() * 1e-9 - firstFrame, renderTime, 0, *turntable);
+	}
+	if (headlessFrames > 0 && raytracer)
+		printf("Ray tracer: %.2f ms per frame, %.1f million rays/s, %zu rays per frame\n",
+			1000 * renderTime / headlessFrames, raytracer->rays / raytracer->renderSeconds * 1e-6,
+			raytracer->rays / headlessFrames);
+	else if (headlessFrames > 0)
+		printf("Software: %.2f ms per frame, %.2f ms setup and binning, %.2f ms rasterization, %zu of %zu triangles binned\n",
+			1000 * renderTime / headlessFrames, 1000 * rasterizer->setupSeconds / headlessFrames,
+			1000 * rasterizer->rasterSeconds / headlessFrames, rasterizer->trianglesBinned / headlessFrames,
+			rasterizer->triangles / headlessFrames);
+	if (!outputPath.empty()) {
+		if (raytracer)
+			raytracer->read(rgb);
+		else
+			rasterizer->read(rgb);
+		saveOutput(rgb, headlessWidth, headlessHeight);
+	}
+	return 0;
 }
\ No newline at end of file
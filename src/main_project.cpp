@@ -17,6 +17,15 @@ Eigen::MatrixXf V(2,3);
 
 void getCursorWorldPos(GLFWwindow* window, double & xworld, double & yworld);
 
+// Move the first vertex, marking it for upload only if it actually moved
+void moveFirstVertex(float x, float y)
+{
+    if (V(0, 0) == x && V(1, 0) == y)
+        return;
+    V.col(0) << x, y;
+    VBO.markDirty(0, 1);
+}
+
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 {
     // Get the position of the mouse in the window
@@ -26,32 +35,28 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 
     // Update the position of the first vertex if the left button is pressed
     if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
-        V.col(0) << xworld, yworld;
-
-    // Upload the change to the GPU
-    VBO.update(V);
+        moveFirstVertex(xworld, yworld);
 }
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
     // Update the position of the first vertex if the keys 1,2, or 3 are pressed
+    if (action == GLFW_RELEASE)
+        return;
     switch (key)
     {
         case  GLFW_KEY_1:
-            V.col(0) << -0.5,  0.5;
+            moveFirstVertex(-0.5,  0.5);
             break;
         case GLFW_KEY_2:
-            V.col(0) << 0,  0.5;
+            moveFirstVertex(0,  0.5);
             break;
         case  GLFW_KEY_3:
-            V.col(0) << 0.5,  0.5;
+            moveFirstVertex(0.5,  0.5);
             break;
         default:
             break;
     }
-
-    // Upload the change to the GPU
-    VBO.update(V);
 }
 
 int main(void)
@@ -189,6 +194,9 @@ int main(void)
         // Bind your program
         program.bind();
 
+        // Upload the vertices changed since the last frame
+        VBO.flush(V);
+
         // Clear the framebuffer
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);